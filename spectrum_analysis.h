@@ -0,0 +1,660 @@
+// Spectrum Seekbar V10 - platform independent analysis, beat detection, frame timeline and trace format
+// Shared by the component and the headless tools; must not depend on the foobar2000 SDK or Windows
+#pragma once
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#include <xmmintrin.h>
+#define SPECTRUM_USE_SSE 1
+#endif
+
+inline void spectrum_lerp_frames(float* out, const float* a, const float* b, float t, int count) {
+    int i = 0;
+#ifdef SPECTRUM_USE_SSE
+    __m128 vt = _mm_set1_ps(t);
+    for (; i + 4 <= count; i += 4) {
+        __m128 va = _mm_loadu_ps(a + i);
+        __m128 vb = _mm_loadu_ps(b + i);
+        _mm_storeu_ps(out + i, _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), vt)));
+    }
+#endif
+    for (; i < count; i++) {
+        out[i] = a[i] + (b[i] - a[i]) * t;
+    }
+}
+
+// Bars, peaks and per-channel bars computed from FFT magnitude chunks
+class spectrum_analyzer {
+public:
+    static const int NUM_BARS = 32;
+    static const int HANDOFF_FRAMES = 15;  // track change / stop cross-fade, 250 ms at 60 Hz
+
+    // A frame is all four arrays back to back so it can be copied/interpolated in one pass
+    enum FrameLayout {
+        FRAME_BARS = 0,
+        FRAME_PEAKS = NUM_BARS,
+        FRAME_LEFT = NUM_BARS * 2,
+        FRAME_RIGHT = NUM_BARS * 3,
+        FRAME_FLOATS = NUM_BARS * 4
+    };
+
+private:
+    float m_bars[NUM_BARS];
+    float m_peaks[NUM_BARS];
+    float m_bars_left[NUM_BARS];
+    float m_bars_right[NUM_BARS];
+    float m_levels[NUM_BARS];   // unsmoothed combined level of the last frame
+
+    // Output cross-fades from this snapshot to the live state while m_handoff_frame < HANDOFF_FRAMES
+    float m_handoff_from[FRAME_FLOATS];
+    int m_handoff_frame;
+
+    void clear_state() {
+        memset(m_levels, 0, sizeof(m_levels));
+        memset(m_bars, 0, sizeof(m_bars));
+        memset(m_peaks, 0, sizeof(m_peaks));
+        memset(m_bars_left, 0, sizeof(m_bars_left));
+        memset(m_bars_right, 0, sizeof(m_bars_right));
+    }
+
+    void advance_handoff() {
+        if (m_handoff_frame < HANDOFF_FRAMES) m_handoff_frame++;
+    }
+
+public:
+    spectrum_analyzer() : m_handoff_frame(HANDOFF_FRAMES) { clear_state(); }
+
+    void reset() {
+        clear_state();
+        m_handoff_frame = HANDOFF_FRAMES;
+    }
+
+    // Start a cross-fade from what is currently shown. The live state starts over, so the
+    // output fades into the next track's analysis alone (or out, on stop) instead of into
+    // the previous track's release.
+    void begin_handoff() {
+        capture(m_handoff_from);
+        m_handoff_frame = 0;
+        clear_state();
+    }
+
+    const float* bars() const { return m_bars; }
+    const float* peaks() const { return m_peaks; }
+    const float* bars_left() const { return m_bars_left; }
+    const float* bars_right() const { return m_bars_right; }
+    const float* levels() const { return m_levels; }
+
+    // Frames without analysis data (stopped, no stream)
+    void decay() {
+        for (int i = 0; i < NUM_BARS; i++) {
+            m_bars[i] *= 0.9f;
+            if (m_bars[i] < 0.01f) m_bars[i] = 0;
+            m_bars_left[i] *= 0.9f;
+            if (m_bars_left[i] < 0.01f) m_bars_left[i] = 0;
+            m_bars_right[i] *= 0.9f;
+            if (m_bars_right[i] < 0.01f) m_bars_right[i] = 0;
+            m_peaks[i] *= 0.98f;
+            if (m_peaks[i] < 0.01f) m_peaks[i] = 0;
+        }
+        advance_handoff();
+    }
+
+    void capture(float* out) const {
+        memcpy(out + FRAME_BARS, m_bars, sizeof(m_bars));
+        memcpy(out + FRAME_PEAKS, m_peaks, sizeof(m_peaks));
+        memcpy(out + FRAME_LEFT, m_bars_left, sizeof(m_bars_left));
+        memcpy(out + FRAME_RIGHT, m_bars_right, sizeof(m_bars_right));
+
+        if (m_handoff_frame < HANDOFF_FRAMES) {
+            // Smoothstep weight so the fade starts and ends without a visible kink
+            float t = (float)m_handoff_frame / HANDOFF_FRAMES;
+            spectrum_lerp_frames(out, m_handoff_from, out, t * t * (3 - 2 * t), FRAME_FLOATS);
+        }
+    }
+
+    // data: interleaved magnitude bins, 'samples' bins per channel
+    template<typename T>
+    void process(const T* data, unsigned samples, unsigned channels) {
+        if (samples == 0 || channels == 0) return;
+
+        for (int bar = 0; bar < NUM_BARS; bar++) {
+            float freq_start = powf(2.0f, (float)bar / 4.0f);
+            float freq_end = powf(2.0f, (float)(bar + 1) / 4.0f);
+
+            int bin_start = (int)(freq_start * samples / 512.0f);
+            int bin_end = (int)(freq_end * samples / 512.0f);
+
+            if (bin_start >= (int)samples) bin_start = samples - 1;
+            if (bin_end > (int)samples) bin_end = samples;
+            if (bin_start >= bin_end) bin_end = bin_start + 1;
+
+            float sum = 0;
+            int count = 0;
+
+            float sum_left = 0, sum_right = 0;
+
+            for (int i = bin_start; i < bin_end && i < (int)samples; i++) {
+                if (channels == 1) {
+                    float val = (float)data[i];
+                    sum += val * val;
+                    sum_left += val * val;
+                    sum_right += val * val;
+                } else if (channels >= 2) {
+                    float val_left = (float)data[i * channels];
+                    float val_right = (float)data[i * channels + 1];
+                    sum += (val_left * val_left + val_right * val_right) / 2;
+                    sum_left += val_left * val_left;
+                    sum_right += val_right * val_right;
+                }
+                count++;
+            }
+
+            if (count > 0) {
+                // Combined channel
+                float magnitude = sqrtf(sum / count);
+                float db = 20.0f * log10f(magnitude + 1e-10f);
+                float normalized = (db + 60.0f) / 60.0f;
+                if (normalized < 0) normalized = 0;
+                if (normalized > 1) normalized = 1;
+
+                float target = normalized;
+                m_levels[bar] = target;
+                if (target >= m_bars[bar]) {
+                    m_bars[bar] = m_bars[bar] + (target - m_bars[bar]) * 0.5f;
+                } else {
+                    m_bars[bar] = m_bars[bar] * 0.9f;
+                }
+
+                // Left channel
+                float magnitude_left = sqrtf(sum_left / count);
+                float db_left = 20.0f * log10f(magnitude_left + 1e-10f);
+                float normalized_left = (db_left + 60.0f) / 60.0f;
+                if (normalized_left < 0) normalized_left = 0;
+                if (normalized_left > 1) normalized_left = 1;
+
+                if (normalized_left >= m_bars_left[bar]) {
+                    m_bars_left[bar] = m_bars_left[bar] + (normalized_left - m_bars_left[bar]) * 0.5f;
+                } else {
+                    m_bars_left[bar] = m_bars_left[bar] * 0.9f;
+                }
+
+                // Right channel
+                float magnitude_right = sqrtf(sum_right / count);
+                float db_right = 20.0f * log10f(magnitude_right + 1e-10f);
+                float normalized_right = (db_right + 60.0f) / 60.0f;
+                if (normalized_right < 0) normalized_right = 0;
+                if (normalized_right > 1) normalized_right = 1;
+
+                if (normalized_right >= m_bars_right[bar]) {
+                    m_bars_right[bar] = m_bars_right[bar] + (normalized_right - m_bars_right[bar]) * 0.5f;
+                } else {
+                    m_bars_right[bar] = m_bars_right[bar] * 0.9f;
+                }
+
+                if (m_bars[bar] >= m_peaks[bar]) {
+                    m_peaks[bar] = m_bars[bar];
+                } else {
+                    m_peaks[bar] *= 0.98f;
+                }
+            }
+        }
+
+        advance_handoff();
+    }
+};
+
+// Ring of timestamped analysis frames, interpolated at presentation time
+class spectrum_frame_history {
+public:
+    static const int ANALYSIS_RATE = 60;
+    static const int FRAME_HISTORY = 8;
+
+private:
+    struct spectrum_frame {
+        double time;
+        float values[spectrum_analyzer::FRAME_FLOATS];
+    };
+
+    spectrum_frame m_frames[FRAME_HISTORY];
+    int m_head;
+    int m_count;
+
+public:
+    spectrum_frame_history() : m_head(0), m_count(0) {}
+
+    void reset() { m_count = 0; }
+    int count() const { return m_count; }
+    double newest_time() const { return m_count > 0 ? m_frames[m_head].time : 0; }
+
+    void push(double time, const spectrum_analyzer& analyzer) {
+        m_head = (m_head + 1) % FRAME_HISTORY;
+        m_frames[m_head].time = time;
+        analyzer.capture(m_frames[m_head].values);
+        if (m_count < FRAME_HISTORY) m_count++;
+    }
+
+    // Returns false when there is nothing to interpolate
+    bool interpolate(double time, float* out) const {
+        if (m_count == 0) return false;
+
+        const size_t frame_size = sizeof(m_frames[0].values);
+        const spectrum_frame& newest = m_frames[m_head];
+        if (time >= newest.time) {
+            memcpy(out, newest.values, frame_size);
+            return true;
+        }
+
+        // Walk back to the pair of frames bracketing the presentation time
+        const spectrum_frame* later = &newest;
+        for (int i = 1; i < m_count; i++) {
+            const spectrum_frame& earlier = m_frames[(m_head - i + FRAME_HISTORY) % FRAME_HISTORY];
+            if (earlier.time <= time) {
+                float t = (float)((time - earlier.time) / (later->time - earlier.time));
+                spectrum_lerp_frames(out, earlier.values, later->values, t, spectrum_analyzer::FRAME_FLOATS);
+                return true;
+            }
+            later = &earlier;
+        }
+
+        // Older than anything kept - hold the oldest frame
+        memcpy(out, later->values, frame_size);
+        return true;
+    }
+};
+
+// Onset and tempo detection from per-bar spectral flux, one call per analysis frame.
+// Fixed memory and O(NUM_BARS + lag range) work per frame: the autocorrelation is
+// updated incrementally with exponential forgetting instead of being recomputed.
+class spectrum_beat_detector {
+public:
+    static const int FRAME_RATE = spectrum_frame_history::ANALYSIS_RATE;
+    static const int MIN_BPM = 60;
+    static const int MAX_BPM = 200;
+    static const int MIN_LAG = FRAME_RATE * 60 / MAX_BPM;
+    static const int MAX_LAG = FRAME_RATE * 60 / MIN_BPM;
+
+private:
+    // One lag beyond each end of the search range, so peaks at the ends can be interpolated
+    static const int ACF_MIN_LAG = MIN_LAG - 1;
+    static const int ACF_MAX_LAG = MAX_LAG + 1;
+    static const int HISTORY = ACF_MAX_LAG + 1;
+
+    float m_previous[spectrum_analyzer::NUM_BARS];
+    float m_strength[HISTORY];          // ring of past onset strengths
+    float m_acf[HISTORY];               // decayed autocorrelation per lag
+    float m_energy;                     // decayed autocorrelation at lag 0
+    float m_mean;                       // running flux statistics for the adaptive threshold
+    float m_variance;
+    int m_head;
+    int m_since_onset;
+    bool m_onset;
+    float m_accent;
+    float m_bpm;
+    float m_confidence;
+
+    float lag_support(int lag) const {
+        return m_acf[lag - 1] + m_acf[lag] + m_acf[lag + 1];
+    }
+
+public:
+    spectrum_beat_detector() { reset(); }
+
+    void reset() {
+        memset(m_previous, 0, sizeof(m_previous));
+        memset(m_strength, 0, sizeof(m_strength));
+        memset(m_acf, 0, sizeof(m_acf));
+        m_energy = 0;
+        m_mean = 0;
+        m_variance = 0;
+        m_head = 0;
+        m_since_onset = MAX_LAG;
+        m_onset = false;
+        m_accent = 0;
+        m_bpm = 0;
+        m_confidence = 0;
+    }
+
+    // True if the last frame was an onset
+    bool onset() const { return m_onset; }
+
+    // 1 on an onset, decaying towards 0 - drives visual accents
+    float accent() const { return m_accent; }
+
+    // Tempo estimate, 0 until the autocorrelation is confident enough
+    float bpm() const { return m_confidence >= 0.3f ? m_bpm : 0; }
+    float confidence() const { return m_confidence; }
+
+    // Frames without analysis data (stopped, no stream)
+    void decay() {
+        m_onset = false;
+        m_accent *= 0.85f;
+    }
+
+    void process(const float* levels) {
+        // Half-wave rectified spectral flux, averaged over bars
+        float flux = 0;
+        for (int i = 0; i < spectrum_analyzer::NUM_BARS; i++) {
+            float diff = levels[i] - m_previous[i];
+            if (diff > 0) flux += diff;
+            m_previous[i] = levels[i];
+        }
+        flux /= spectrum_analyzer::NUM_BARS;
+
+        // Adaptive threshold from the statistics before this frame
+        float threshold = m_mean + 1.5f * sqrtf(m_variance);
+        float strength = flux > m_mean ? flux - m_mean : 0;
+
+        float delta = flux - m_mean;
+        m_mean += delta * 0.05f;
+        m_variance = (m_variance + delta * delta * 0.05f) * 0.95f;
+
+        m_since_onset++;
+        m_onset = flux > threshold && flux > 0.02f && m_since_onset >= MIN_LAG / 2;
+        if (m_onset) m_since_onset = 0;
+        m_accent = m_onset ? 1.0f : m_accent * 0.85f;
+
+        // Incremental autocorrelation of onset strength over the tempo lag range
+        const float forget = 0.995f;
+        m_energy = m_energy * forget + strength * strength;
+        for (int lag = ACF_MIN_LAG; lag <= ACF_MAX_LAG; lag++) {
+            float past = m_strength[(m_head - lag + HISTORY) % HISTORY];
+            m_acf[lag] = m_acf[lag] * forget + strength * past;
+        }
+        m_strength[m_head] = strength;
+        m_head = (m_head + 1) % HISTORY;
+
+        // Strongest lag, mildly weighted towards 120 BPM to settle octave ambiguity
+        int best = 0;
+        float best_score = 0;
+        for (int lag = MIN_LAG; lag <= MAX_LAG; lag++) {
+            float octaves = fabsf(log2f((60.0f * FRAME_RATE / lag) / 120.0f));
+            float score = m_acf[lag] * (1.0f - 0.1f * octaves);
+            if (score > best_score) {
+                best_score = score;
+                best = lag;
+            }
+        }
+
+        if (best == 0 || m_energy <= 0) {
+            m_confidence = 0;
+            return;
+        }
+
+        // A pulse every L/2 or L/3 frames also peaks at L, and the prior above favours
+        // the slower multiple for fast tempos - take the fastest period with comparable
+        // support. Sums over neighbouring lags, as a period between two lags splits its peak.
+        float support = lag_support(best);
+        for (int divisor = 3; divisor >= 2; divisor--) {
+            int lag = (best + divisor / 2) / divisor;
+            if (lag < MIN_LAG || lag_support(lag) < 0.8f * support) continue;
+
+            best = lag;
+            if (lag > MIN_LAG && m_acf[lag - 1] > m_acf[best]) best = lag - 1;
+            if (m_acf[lag + 1] > m_acf[best]) best = lag + 1;
+            break;
+        }
+
+        // Parabolic interpolation for a sub-frame period
+        float period = (float)best;
+        float a = m_acf[best - 1], b = m_acf[best], c = m_acf[best + 1];
+        float denominator = a - 2 * b + c;
+        if (denominator < 0) period += 0.5f * (a - c) / denominator;
+
+        m_bpm = 60.0f * FRAME_RATE / period;
+        m_confidence = m_acf[best] / m_energy;
+    }
+};
+
+// Trace files - everything the component received from the visualisation stream
+// and the timer, so a stutter report can be replayed headless.
+// Layout (native little-endian): header, then records of
+//   TRACE_TICK/TRACE_PAINT/TRACE_HANDOFF/TRACE_RESET/TRACE_HOLD: u8 type, f64 wall_time, u8 has_time, f64 time
+//   TRACE_CHUNK:            u8 type, f64 time, u32 sample_rate, u32 channels, u32 samples, u16 level[samples * channels]
+// Chunk magnitudes are stored as dB in 1/256 dB steps above TRACE_DB_MIN (0 = silence),
+// about 2 KB per analysis frame for a stereo 1024 point FFT.
+enum spectrum_trace_record_type {
+    TRACE_TICK = 1,     // timer tick; time = stream absolute time
+    TRACE_CHUNK = 2,    // spectrum chunk analysed for the grid frame at 'time'
+    TRACE_PAINT = 3,    // paint; time = presentation time (latency applied)
+    TRACE_HANDOFF = 4,  // cross-fade starts; has_time = fade to silence, time = grid frame it starts on
+    TRACE_RESET = 5,    // frame history dropped (start, seek, stall, stop, latency change)
+    TRACE_HOLD = 6      // timer tick holding the last frame until a stop is heard; nothing decays
+};
+
+struct spectrum_trace_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t num_bars;
+    uint32_t analysis_rate;
+};
+
+static const char SPECTRUM_TRACE_MAGIC[4] = {'S', 'S', 'B', 'T'};
+// Bump whenever a record type is added or a field changes meaning - readers reject
+// other versions rather than misreading them.
+//   1 tick, chunk, paint   2 reset   3 u16 dB chunks   4 handoff at the compensated boundary
+//   5 hold
+static const uint32_t SPECTRUM_TRACE_VERSION = 5;
+
+static const float TRACE_DB_MIN = -160.0f;
+static const float TRACE_DB_STEPS = 256.0f;
+
+inline uint16_t spectrum_trace_encode(float magnitude) {
+    if (!(magnitude > 0)) return 0;
+    float code = (20.0f * log10f(magnitude) - TRACE_DB_MIN) * TRACE_DB_STEPS + 0.5f;
+    if (code < 1) return 1;
+    if (code > 65535) return 65535;
+    return (uint16_t)code;
+}
+
+inline float spectrum_trace_decode(uint16_t code) {
+    if (code == 0) return 0;
+    return powf(10.0f, (code / TRACE_DB_STEPS + TRACE_DB_MIN) / 20.0f);
+}
+
+struct spectrum_trace_record {
+    int type;
+    double wall_time;
+    double time;
+    bool has_time;
+    uint32_t sample_rate;
+    uint32_t channels;
+    uint32_t samples;
+    std::vector<float> data;
+};
+
+// Records are encoded into blocks on the calling (UI) thread; full blocks go to a
+// worker thread for the fwrite, so recording never waits on the disk unless the
+// disk falls more than MAX_PENDING blocks behind
+class spectrum_trace_writer {
+    static const size_t BLOCK_SIZE = 1 << 16;
+    static const size_t MAX_PENDING = 256;
+
+    FILE* m_file;
+    std::vector<uint8_t> m_block;
+    std::vector<std::vector<uint8_t> > m_pending;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_drained;
+    std::thread m_worker;
+    bool m_stop;
+
+    template<typename T> void put(const T& value) {
+        const uint8_t* bytes = (const uint8_t*)&value;
+        m_block.insert(m_block.end(), bytes, bytes + sizeof(value));
+        if (m_block.size() >= BLOCK_SIZE) submit();
+    }
+
+    void submit() {
+        if (m_block.empty()) return;
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_drained.wait(lock, [this] { return m_pending.size() < MAX_PENDING; });
+        m_pending.push_back(std::vector<uint8_t>());
+        m_pending.back().swap(m_block);
+        m_block.reserve(BLOCK_SIZE + 64);
+        m_wake.notify_one();
+    }
+
+    void run() {
+        std::vector<std::vector<uint8_t> > blocks;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait(lock, [this] { return m_stop || !m_pending.empty(); });
+                if (m_pending.empty()) return;
+                blocks.swap(m_pending);
+                m_drained.notify_all();
+            }
+
+            for (size_t i = 0; i < blocks.size(); i++) fwrite(&blocks[i][0], 1, blocks[i].size(), m_file);
+            blocks.clear();
+        }
+    }
+
+public:
+    spectrum_trace_writer() : m_file(NULL), m_stop(false) {}
+    ~spectrum_trace_writer() { close(); }
+
+    bool is_open() const { return m_file != NULL; }
+
+    // Takes ownership of an opened (binary, write) file
+    void open(FILE* file) {
+        close();
+        m_file = file;
+        if (!m_file) return;
+
+        m_block.clear();
+        m_block.reserve(BLOCK_SIZE + 64);
+        m_stop = false;
+        m_worker = std::thread(&spectrum_trace_writer::run, this);
+
+        spectrum_trace_header header;
+        memcpy(header.magic, SPECTRUM_TRACE_MAGIC, sizeof(header.magic));
+        header.version = SPECTRUM_TRACE_VERSION;
+        header.num_bars = spectrum_analyzer::NUM_BARS;
+        header.analysis_rate = spectrum_frame_history::ANALYSIS_RATE;
+        put(header);
+    }
+
+    void close() {
+        if (!m_file) return;
+
+        submit();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+            m_wake.notify_one();
+        }
+        m_worker.join();
+
+        fclose(m_file);
+        m_file = NULL;
+    }
+
+    void write_event(int type, double wall_time, bool has_time, double time) {
+        if (!m_file) return;
+        put((uint8_t)type);
+        put(wall_time);
+        put((uint8_t)(has_time ? 1 : 0));
+        put(time);
+    }
+
+    template<typename T>
+    void write_chunk(double time, uint32_t sample_rate, uint32_t channels, uint32_t samples, const T* data) {
+        if (!m_file) return;
+        put((uint8_t)TRACE_CHUNK);
+        put(time);
+        put(sample_rate);
+        put(channels);
+        put(samples);
+
+        size_t count = (size_t)samples * channels;
+        for (size_t i = 0; i < count; i++) put(spectrum_trace_encode((float)data[i]));
+    }
+};
+
+class spectrum_trace_reader {
+    // Far beyond anything the visualisation stream delivers - larger counts mean a corrupt record
+    static const uint32_t MAX_CHANNELS = 8;
+    static const uint32_t MAX_SAMPLES = 65536;
+
+    FILE* m_file;
+    spectrum_trace_header m_header;
+    std::vector<uint16_t> m_codes;
+    const char* m_error;
+    long m_record_offset;
+
+    bool fail(const char* error) {
+        m_error = error;
+        return false;
+    }
+
+    template<typename T> bool get(T& value) { return fread(&value, sizeof(value), 1, m_file) == 1; }
+
+public:
+    spectrum_trace_reader() : m_file(NULL), m_error(NULL), m_record_offset(0) { memset(&m_header, 0, sizeof(m_header)); }
+    ~spectrum_trace_reader() { if (m_file) fclose(m_file); }
+
+    const spectrum_trace_header& header() const { return m_header; }
+
+    // Why next() returned false, or NULL at a clean end of file
+    const char* error() const { return m_error; }
+
+    // File offset of the record last read (or rejected)
+    long offset() const { return m_record_offset; }
+
+    // Takes ownership of an opened (binary, read) file; false if it is not a compatible trace
+    bool open(FILE* file) {
+        m_file = file;
+        if (!m_file || !get(m_header)) return false;
+        return memcmp(m_header.magic, SPECTRUM_TRACE_MAGIC, sizeof(m_header.magic)) == 0
+            && m_header.version == SPECTRUM_TRACE_VERSION
+            && m_header.num_bars == (uint32_t)spectrum_analyzer::NUM_BARS;
+    }
+
+    // False at end of file, on a truncated or implausible record or an unknown record type (see error())
+    bool next(spectrum_trace_record& record) {
+        uint8_t type = 0;
+        if (!m_file) return false;
+        m_record_offset = ftell(m_file);
+        if (!get(type)) return false;
+        record.type = type;
+
+        if (type == TRACE_CHUNK) {
+            record.has_time = true;
+            record.wall_time = 0;
+            if (!get(record.time) || !get(record.sample_rate) || !get(record.channels) || !get(record.samples)) {
+                return fail("truncated chunk record");
+            }
+            if (record.channels > MAX_CHANNELS || record.samples > MAX_SAMPLES) return fail("implausible chunk size");
+
+            size_t count = (size_t)record.samples * record.channels;
+            m_codes.resize(count);
+            record.data.resize(count);
+            if (count > 0 && fread(&m_codes[0], sizeof(uint16_t), count, m_file) != count) {
+                return fail("truncated chunk record");
+            }
+            for (size_t i = 0; i < count; i++) record.data[i] = spectrum_trace_decode(m_codes[i]);
+            return true;
+        }
+
+        if (type != TRACE_TICK && type != TRACE_PAINT && type != TRACE_HANDOFF && type != TRACE_RESET &&
+            type != TRACE_HOLD) {
+            return fail("unknown record type");
+        }
+
+        uint8_t has_time = 0;
+        if (!get(record.wall_time) || !get(has_time) || !get(record.time)) return fail("truncated event record");
+        record.has_time = has_time != 0;
+        record.samples = record.channels = record.sample_rate = 0;
+        return true;
+    }
+};
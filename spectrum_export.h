@@ -0,0 +1,187 @@
+// Spectrum Seekbar V10 - frame export for other components and local processes
+// Self-contained so consumers can copy it into their own projects. The foobar2000 service
+// declaration at the bottom is only compiled when the foobar2000 SDK is included first.
+//
+// Frames live in a ring of seqlock-protected slots written by a single writer (the UI thread
+// of the component). Readers never block the writer and never call back into it: they read
+// the newest slot and retry if its sequence number changed underneath them.
+//
+// Out of process the same buffer is available, when enabled in the component's menu, as a
+// session-local named file mapping (SPECTRUM_EXPORT_MAPPING_NAME); it is never exposed on
+// the network. The writing process holds SPECTRUM_EXPORT_WRITER_MUTEX_NAME, so readers may
+// keep the mapping open across writer restarts.
+//
+// Staleness: writer_alive is cleared when the writer stops exporting or shuts down. A writer
+// that crashed can't clear it, but while a writer is alive write_count advances at the
+// analysis rate (60 Hz, also while playback is stopped) - treat a write_count that hasn't
+// moved for about a second as stale.
+//
+// Waking up for new frames instead of polling: two manual-reset events alternate, event
+// frame_number % 2 is signalled when that frame is published and the other one is reset
+// just before, so any number of readers can wait. After reading frame n, wait on the event
+// for n + 1 (SPECTRUM_EXPORT_FRAME_EVENT_NAME_0/_1 out of process, spectrum_export::
+// get_frame_event in process) with a timeout, then read the newest frame. A reader that is
+// two frames behind when it starts waiting wakes one frame late, it never misses a wake.
+// Out of process, open the events with OpenEvent(SYNCHRONIZE, ...), or create them with
+// CreateEvent(NULL, TRUE, FALSE, ...) to wait for a writer that isn't running yet.
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+#define SPECTRUM_EXPORT_MAPPING_NAME L"Local\\foo_spectrum_seekbar_v10_frames"
+#define SPECTRUM_EXPORT_WRITER_MUTEX_NAME L"Local\\foo_spectrum_seekbar_v10_frames_writer"
+#define SPECTRUM_EXPORT_FRAME_EVENT_NAME_0 L"Local\\foo_spectrum_seekbar_v10_frames_event_0"
+#define SPECTRUM_EXPORT_FRAME_EVENT_NAME_1 L"Local\\foo_spectrum_seekbar_v10_frames_event_1"
+
+static const uint32_t SPECTRUM_EXPORT_MAGIC = 0x58455353;  // "SSEX"
+static const uint32_t SPECTRUM_EXPORT_VERSION = 2;
+static const uint32_t SPECTRUM_EXPORT_BARS = 32;
+static const uint32_t SPECTRUM_EXPORT_SLOTS = 16;
+
+enum spectrum_export_flags {
+    SPECTRUM_EXPORT_PLAYING = 1 << 0,
+    SPECTRUM_EXPORT_ONSET = 1 << 1
+};
+
+struct spectrum_export_frame {
+    uint32_t frame_number;      // increments by one per published frame
+    uint32_t flags;             // spectrum_export_flags
+    double time;                // visualisation stream time of the analysis frame, 0 while stopped
+    double track_position;      // playback position, seconds
+    double track_length;        // 0 when unknown
+    float bpm;                  // 0 when no confident estimate
+    float accent;               // beat accent envelope, 1 on onset decaying towards 0
+    float bars[SPECTRUM_EXPORT_BARS];       // all values 0..1
+    float peaks[SPECTRUM_EXPORT_BARS];
+    float bars_left[SPECTRUM_EXPORT_BARS];
+    float bars_right[SPECTRUM_EXPORT_BARS];
+};
+
+struct spectrum_export_slot {
+    std::atomic<uint32_t> sequence;     // odd while the slot is being written
+    uint32_t reserved;
+    spectrum_export_frame frame;
+};
+
+struct spectrum_export_buffer {
+    uint32_t magic;                     // SPECTRUM_EXPORT_MAGIC once initialised
+    uint32_t version;                   // SPECTRUM_EXPORT_VERSION
+    uint32_t num_bars;
+    uint32_t slot_count;
+    uint32_t frame_size;                // sizeof(spectrum_export_frame)
+    std::atomic<uint32_t> write_count;  // frames published so far; newest is slot (write_count - 1) % slot_count
+    std::atomic<uint32_t> writer_alive; // 1 while a writer is publishing
+    spectrum_export_slot slots[SPECTRUM_EXPORT_SLOTS];
+};
+
+// Writer side - call once the writer owns the buffer. Works on zero-filled memory and on
+// a buffer left behind by an earlier writer that readers kept mapped.
+inline void spectrum_export_init(spectrum_export_buffer* buffer) {
+    // Readers see an invalid buffer while the header is rewritten
+    buffer->magic = 0;
+    std::atomic_thread_fence(std::memory_order_release);
+    buffer->writer_alive.store(0, std::memory_order_relaxed);
+
+    // Frames of an earlier writer may be torn (it died mid-write) - start over empty,
+    // and make every slot writable again
+    buffer->write_count.store(0, std::memory_order_relaxed);
+    for (uint32_t i = 0; i < SPECTRUM_EXPORT_SLOTS; i++) {
+        uint32_t sequence = buffer->slots[i].sequence.load(std::memory_order_relaxed);
+        if (sequence & 1) buffer->slots[i].sequence.store(sequence + 1, std::memory_order_relaxed);
+    }
+
+    buffer->version = SPECTRUM_EXPORT_VERSION;
+    buffer->num_bars = SPECTRUM_EXPORT_BARS;
+    buffer->slot_count = SPECTRUM_EXPORT_SLOTS;
+    buffer->frame_size = sizeof(spectrum_export_frame);
+    std::atomic_thread_fence(std::memory_order_release);
+    buffer->magic = SPECTRUM_EXPORT_MAGIC;
+}
+
+inline void spectrum_export_set_alive(spectrum_export_buffer* buffer, bool alive) {
+    buffer->writer_alive.store(alive ? 1 : 0, std::memory_order_release);
+}
+
+inline void spectrum_export_write(spectrum_export_buffer* buffer, const spectrum_export_frame& frame) {
+    uint32_t count = buffer->write_count.load(std::memory_order_relaxed);
+    spectrum_export_slot& slot = buffer->slots[count % SPECTRUM_EXPORT_SLOTS];
+
+    uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    memcpy(&slot.frame, &frame, sizeof(frame));
+
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+    buffer->write_count.store(count + 1, std::memory_order_release);
+}
+
+// Reader side, zero-copy: read what you need from latest_slot()->frame between
+// read_begin and read_end, and discard it if read_end returns false
+inline bool spectrum_export_valid(const spectrum_export_buffer* buffer) {
+    return buffer->magic == SPECTRUM_EXPORT_MAGIC && buffer->version == SPECTRUM_EXPORT_VERSION
+        && buffer->frame_size == sizeof(spectrum_export_frame);
+}
+
+// False once the writer stopped exporting or shut down - the latest frame is then stale
+inline bool spectrum_export_writer_alive(const spectrum_export_buffer* buffer) {
+    return buffer->writer_alive.load(std::memory_order_acquire) != 0;
+}
+
+// NULL until the first frame is published
+inline const spectrum_export_slot* spectrum_export_latest_slot(const spectrum_export_buffer* buffer) {
+    uint32_t count = buffer->write_count.load(std::memory_order_acquire);
+    return count > 0 ? &buffer->slots[(count - 1) % SPECTRUM_EXPORT_SLOTS] : NULL;
+}
+
+// Returns false if the slot is being written right now - pick the latest slot again
+inline bool spectrum_export_read_begin(const spectrum_export_slot* slot, uint32_t& sequence) {
+    sequence = slot->sequence.load(std::memory_order_acquire);
+    return (sequence & 1) == 0;
+}
+
+inline bool spectrum_export_read_end(const spectrum_export_slot* slot, uint32_t sequence) {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot->sequence.load(std::memory_order_relaxed) == sequence;
+}
+
+// Convenience: copy the newest consistent frame; false if none is published yet
+// or the writer kept overwriting it (only possible if the reader is descheduled for
+// a full lap of the ring)
+inline bool spectrum_export_read_latest(const spectrum_export_buffer* buffer, spectrum_export_frame& out) {
+    if (!spectrum_export_valid(buffer)) return false;
+
+    for (int attempt = 0; attempt < 4; attempt++) {
+        const spectrum_export_slot* slot = spectrum_export_latest_slot(buffer);
+        if (!slot) return false;
+
+        uint32_t sequence;
+        if (!spectrum_export_read_begin(slot, sequence)) continue;
+        memcpy(&out, &slot->frame, sizeof(out));
+        if (spectrum_export_read_end(slot, sequence)) return true;
+    }
+    return false;
+}
+
+#ifdef FB2K_MAKE_SERVICE_INTERFACE_ENTRYPOINT
+//! Published by foo_spectrum_seekbar_v10; only present when the component is installed.
+//! Usage: spectrum_export::ptr api; if (service_enum_t<spectrum_export>().first(api)) { ... }
+class NOVTABLE spectrum_export : public service_base {
+    FB2K_MAKE_SERVICE_INTERFACE_ENTRYPOINT(spectrum_export);
+public:
+    //! In-process frame buffer, valid for the lifetime of the process. Frames only flow
+    //! while a Spectrum Seekbar element is visible and analysing.
+    virtual const spectrum_export_buffer* get_buffer() = 0;
+
+    //! Manual-reset event signalled once the frame with this frame_number is published; after
+    //! reading frame n, WaitForSingleObject(get_frame_event(n + 1), timeout). Valid for the
+    //! lifetime of the process - don't close it.
+    virtual HANDLE get_frame_event(uint32_t frame_number) = 0;
+};
+
+// {7A3C1E52-4B8D-4F61-9C27-5D0E8B6A1F34}
+FOOGUIDDECL const GUID spectrum_export::class_guid =
+{ 0x7a3c1e52, 0x4b8d, 0x4f61, { 0x9c, 0x27, 0x5d, 0x0e, 0x8b, 0x6a, 0x1f, 0x34 } };
+#endif
@@ -6,6 +6,15 @@
 #include <windowsx.h>
 #include <math.h>
 
+#include "spectrum_analysis.h"
+#include "spectrum_export.h"
+
+#ifndef WM_DPICHANGED_AFTERPARENT
+#define WM_DPICHANGED_AFTERPARENT 0x02E3
+#endif
+
+#pragma comment(lib, "msimg32.lib")  // TransparentBlt
+
 DECLARE_COMPONENT_VERSION(
     "Spectrum Seekbar V10",
     "10.0.0",
@@ -14,6 +23,175 @@ DECLARE_COMPONENT_VERSION(
 
 VALIDATE_COMPONENT_FILENAME("foo_spectrum_seekbar_v10.dll");
 
+static_assert(SPECTRUM_EXPORT_BARS == spectrum_analyzer::NUM_BARS, "export frame layout out of sync");
+
+// In-process export buffer - static storage, so it starts zero-filled
+static spectrum_export_buffer g_export_local;
+
+// Frame export shared by all instances; the first instance that publishes owns it
+// until its window goes away, so multiple seekbars don't interleave their frames
+class spectrum_frame_exporter {
+    const void* m_owner;
+    bool m_local_alive;
+    
+    // Shared memory. Which process writes is decided by the named mutex, not by who created
+    // the mapping - readers keep the mapping alive across writers. Once acquired, the mutex
+    // and the mapping are kept for the life of the process; the menu toggle only starts and
+    // stops the writes.
+    HANDLE m_writer_mutex;
+    bool m_writer_owned;
+    HANDLE m_mapping;
+    spectrum_export_buffer* m_shared;
+    HANDLE m_shared_events[2];
+    bool m_shared_enabled;
+    bool m_shared_failed;
+    int m_retry_frames;
+    uint32_t m_frame_number;
+    
+    // Readers wait on these instead of polling, see spectrum_export.h
+    HANDLE m_local_events[2];
+    
+    static const int RETRY_FRAMES = spectrum_frame_history::ANALYSIS_RATE;
+    
+    bool acquire_shared() {
+        if (m_shared) return true;
+        if (m_shared_failed) return false;
+        if (m_retry_frames > 0) {
+            m_retry_frames--;
+            return false;
+        }
+        
+        if (!m_writer_mutex) m_writer_mutex = CreateMutex(NULL, FALSE, SPECTRUM_EXPORT_WRITER_MUTEX_NAME);
+        if (!m_writer_mutex) {
+            shared_failed();
+            return false;
+        }
+        
+        if (!m_writer_owned) {
+            // Abandoned: the previous writer exited without releasing it - take over
+            DWORD wait = WaitForSingleObject(m_writer_mutex, 0);
+            if (wait != WAIT_OBJECT_0 && wait != WAIT_ABANDONED) {
+                // Another foobar2000 instance is exporting - check again in a second
+                m_retry_frames = RETRY_FRAMES;
+                return false;
+            }
+            m_writer_owned = true;
+        }
+        
+        // May already exist while a reader holds it open - reuse it either way
+        m_mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0,
+            sizeof(spectrum_export_buffer), SPECTRUM_EXPORT_MAPPING_NAME);
+        if (m_mapping) {
+            m_shared = (spectrum_export_buffer*)MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0,
+                sizeof(spectrum_export_buffer));
+        }
+        
+        if (!m_shared) {
+            if (m_mapping) CloseHandle(m_mapping);
+            m_mapping = NULL;
+            shared_failed();
+            return false;
+        }
+        
+        // Readers may have created them already, or an earlier writer left one signalled
+        const wchar_t* event_names[2] = { SPECTRUM_EXPORT_FRAME_EVENT_NAME_0, SPECTRUM_EXPORT_FRAME_EVENT_NAME_1 };
+        for (int i = 0; i < 2; i++) {
+            if (!m_shared_events[i]) m_shared_events[i] = CreateEvent(NULL, TRUE, FALSE, event_names[i]);
+            if (m_shared_events[i]) ResetEvent(m_shared_events[i]);
+        }
+        
+        spectrum_export_init(m_shared);
+        return true;
+    }
+    
+    static void signal_frame(HANDLE* events, uint32_t frame_number) {
+        // Re-arm the event readers of this frame wait on next before waking the current ones
+        HANDLE next = events[(frame_number + 1) % 2], current = events[frame_number % 2];
+        if (next) ResetEvent(next);
+        if (current) SetEvent(current);
+    }
+    
+    void shared_failed() {
+        m_shared_failed = true;
+        console::formatter() << "Spectrum Seekbar: shared memory export unavailable";
+    }
+    
+    void set_alive(bool alive) {
+        if (m_local_alive != alive) spectrum_export_set_alive(&g_export_local, alive);
+        m_local_alive = alive;
+        if (m_shared) spectrum_export_set_alive(m_shared, alive && m_shared_enabled);
+    }
+    
+public:
+    spectrum_frame_exporter() : m_owner(NULL), m_local_alive(false),
+                                m_writer_mutex(NULL), m_writer_owned(false), m_mapping(NULL), m_shared(NULL),
+                                m_shared_enabled(false), m_shared_failed(false), m_retry_frames(0),
+                                m_frame_number(0) {
+        for (int i = 0; i < 2; i++) {
+            m_shared_events[i] = NULL;
+            m_local_events[i] = CreateEvent(NULL, TRUE, FALSE, NULL);
+        }
+        spectrum_export_init(&g_export_local);
+    }
+    
+    ~spectrum_frame_exporter() {
+        // The mutex is released by the system when its owning thread exits
+        if (m_shared) {
+            spectrum_export_set_alive(m_shared, false);
+            UnmapViewOfFile(m_shared);
+        }
+        if (m_mapping) CloseHandle(m_mapping);
+        if (m_writer_mutex) CloseHandle(m_writer_mutex);
+        for (int i = 0; i < 2; i++) {
+            if (m_shared_events[i]) CloseHandle(m_shared_events[i]);
+            if (m_local_events[i]) CloseHandle(m_local_events[i]);
+        }
+    }
+    
+    const spectrum_export_buffer* local_buffer() const { return &g_export_local; }
+    HANDLE local_event(uint32_t frame_number) const { return m_local_events[frame_number % 2]; }
+    
+    void publish(const void* instance, spectrum_export_frame& frame, bool shared) {
+        if (m_owner && m_owner != instance) return;
+        m_owner = instance;
+        
+        if (shared != m_shared_enabled) {
+            // Toggling gives a failed or contended export another try right away
+            m_shared_enabled = shared;
+            m_shared_failed = false;
+            m_retry_frames = 0;
+            if (m_shared) spectrum_export_set_alive(m_shared, shared);
+        }
+        
+        frame.frame_number = ++m_frame_number;
+        spectrum_export_write(&g_export_local, frame);
+        if (!m_local_alive) set_alive(true);
+        signal_frame(m_local_events, frame.frame_number);
+        
+        if (m_shared_enabled && acquire_shared()) {
+            spectrum_export_write(m_shared, frame);
+            if (!spectrum_export_writer_alive(m_shared)) spectrum_export_set_alive(m_shared, true);
+            signal_frame(m_shared_events, frame.frame_number);
+        }
+    }
+    
+    void release(const void* instance) {
+        if (m_owner != instance) return;
+        m_owner = NULL;
+        set_alive(false);
+    }
+};
+
+static spectrum_frame_exporter g_exporter;
+
+class spectrum_export_impl : public spectrum_export {
+public:
+    const spectrum_export_buffer* get_buffer() { return g_exporter.local_buffer(); }
+    HANDLE get_frame_event(uint32_t frame_number) { return g_exporter.local_event(frame_number); }
+};
+
+static service_factory_single_t<spectrum_export_impl> g_spectrum_export_factory;
+
 class spectrum_seekbar_v10 : public ui_element_instance, private play_callback_impl_base {
 private:
     HWND m_hwnd;
@@ -23,26 +201,121 @@ private:
     visualisation_stream::ptr m_vis_stream;
     
     // Spectrum data
-    static const int NUM_BARS = 32;
-    float m_bars[NUM_BARS];
-    float m_peaks[NUM_BARS];
-    float m_bars_left[NUM_BARS];
-    float m_bars_right[NUM_BARS];
+    static const int NUM_BARS = spectrum_analyzer::NUM_BARS;
+    spectrum_analyzer m_analyzer;
+    spectrum_beat_detector m_beat;
+    
+    // Analysis frames - produced on a fixed time grid, interpolated at paint time
+    spectrum_frame_history m_frames;
+    t_int64 m_next_frame;
+    float m_display[spectrum_analyzer::FRAME_FLOATS];
+    audio_chunk_impl m_chunk;
+    
+    // Track change / stop cross-fade - queued until the analysis (which runs latency_ms
+    // behind the stream) reaches the boundary, so the fade lines up with what is heard
+    bool m_handoff_pending;
+    bool m_handoff_to_silence;
+    double m_handoff_time;          // stream time of the boundary
+    double m_handoff_deadline;      // wall clock time the boundary is heard
+    
+    // Trace recording - see spectrum_analysis.h and tools/spectrum_replay.cpp
+    spectrum_trace_writer m_trace;
+    
+    // Geometry - computed on resize and DPI change, only indexed while painting
+    struct spectrum_layout {
+        int width;
+        int height;
+        int center_y;           // stereo mirror line
+        int dpi;
+        
+        // Bar columns spread over the full width; neighbours differ by at most a pixel
+        int bar_left[NUM_BARS];
+        int bar_right[NUM_BARS];
+        int bar_center[NUM_BARS];
+        
+        int bar_inset;
+        int block_pitch;
+        int block_size;
+        int block_gap;
+        int block_inset;
+        int dot_radius;
+        int line_width;
+        int position_width;
+        int progress_width;
+        int progress_y;
+        
+        int overlay_top;
+        int overlay_height;
+        int overlay_margin;
+    };
     
-    // Timer
+    spectrum_layout m_layout;
+    
+    // Back buffer, sized with the layout
+    HDC m_back_dc;
+    HBITMAP m_back_bmp;
+    HGDIOBJ m_back_old_bmp;
+    
+    // Timer - drives analysis; paints are paced separately
     UINT_PTR m_timer;
     
+    // Paint pacing - a worker waits for each desktop composition and invalidates,
+    // so paints follow the display refresh rate (120/144 Hz) instead of the timer
+    HANDLE m_pacer;
+    volatile LONG m_pacer_stop;
+    
     // Colors
     COLORREF m_clr_background;
     COLORREF m_clr_bar;
     COLORREF m_clr_played;
     COLORREF m_clr_position;
     
+    // Overlay text - formatted and laid out only when the displayed value changes
+    enum TextFormat {
+        TEXT_ELAPSED = 0,
+        TEXT_REMAINING = 1,
+        TEXT_SAMPLES = 2,
+        TEXT_BITRATE = 3,
+        TEXT_FORMAT_COUNT = 4
+    };
+    
+    struct overlay_text {
+        WCHAR text[64];
+        int length;
+        SIZE extent;
+        t_int64 key[3];     // values the text was formatted from
+    };
+    
+    overlay_text m_time_text;
+    overlay_text m_mode_text;
+    HFONT m_font;
+    HFONT m_overlay_font;   // non-antialiased copy of m_font, owned
+    HDC m_overlay_dc;
+    HBITMAP m_overlay_bmp;
+    HGDIOBJ m_overlay_old_bmp;
+    HGDIOBJ m_overlay_old_font;
+    int m_overlay_width;
+    bool m_overlay_dirty;
+    
     // Playback state
     bool m_is_playing;
     double m_track_length;
     double m_playback_position;
     metadb_handle_ptr m_current_track;
+    unsigned m_sample_rate;
+    t_int64 m_bitrate;
+    
+    // Resolved per-track info - metadb is only queried on a cache miss, at track
+    // change or when prefetching the next track, never from per-second callbacks
+    struct track_info {
+        metadb_handle_ptr handle;
+        double length;
+        t_int64 bitrate;
+    };
+    
+    static const int TRACK_CACHE_SIZE = 8;
+    track_info m_track_cache[TRACK_CACHE_SIZE];
+    int m_track_cache_next;
     
     // Seeking
     bool m_seeking;
@@ -67,31 +340,32 @@ private:
     
     int m_visualization_style;
     int m_channel_mode;
+    int m_latency_ms;
+    int m_text_format;
+    int m_beat_accents;
+    int m_show_bpm;
+    int m_export_shared;
     
 public:
     spectrum_seekbar_v10(ui_element_config::ptr config, ui_element_instance_callback::ptr callback) 
-        : m_callback(callback), m_hwnd(NULL), m_timer(0), m_is_playing(false),
+        : m_callback(callback), m_hwnd(NULL), m_timer(0), m_pacer(NULL), m_pacer_stop(0), m_is_playing(false),
           m_track_length(0), m_playback_position(0), m_seeking(false), 
           m_callbacks_registered(false),
-          m_visualization_style(STYLE_BARS), m_channel_mode(CHANNEL_MONO) {
+          m_visualization_style(STYLE_BARS), m_channel_mode(CHANNEL_MONO), m_latency_ms(0),
+          m_next_frame(0),
+          m_handoff_pending(false), m_handoff_to_silence(false), m_handoff_time(0), m_handoff_deadline(0),
+          m_track_cache_next(0), m_text_format(TEXT_ELAPSED), m_beat_accents(0), m_show_bpm(0), m_export_shared(0), m_sample_rate(0), m_bitrate(0),
+          m_font(NULL), m_overlay_font(NULL), m_overlay_dc(NULL), m_overlay_bmp(NULL), m_overlay_old_bmp(NULL),
+          m_overlay_old_font(NULL), m_overlay_width(0), m_overlay_dirty(true),
+          m_back_dc(NULL), m_back_bmp(NULL), m_back_old_bmp(NULL) {
         
-        memset(m_bars, 0, sizeof(m_bars));
-        memset(m_peaks, 0, sizeof(m_peaks));
-        memset(m_bars_left, 0, sizeof(m_bars_left));
-        memset(m_bars_right, 0, sizeof(m_bars_right));
+        memset(m_display, 0, sizeof(m_display));
+        memset(&m_layout, 0, sizeof(m_layout));
+        reset_overlay_text(m_time_text);
+        reset_overlay_text(m_mode_text);
         
         // Load configuration if available
-        if (config.is_valid() && config->get_data_size() >= 8) {
-            const t_uint8* data = (const t_uint8*)config->get_data();
-            m_visualization_style = *(int*)data;
-            m_channel_mode = *(int*)(data + 4);
-            
-            // Validate loaded values
-            if (m_visualization_style < 0 || m_visualization_style >= STYLE_COUNT)
-                m_visualization_style = STYLE_BARS;
-            if (m_channel_mode < 0 || m_channel_mode >= CHANNEL_COUNT)
-                m_channel_mode = CHANNEL_MONO;
-        }
+        load_configuration(config);
     }
     
     ~spectrum_seekbar_v10() {
@@ -100,6 +374,7 @@ public:
             KillTimer(m_hwnd, m_timer);
             m_timer = 0;
         }
+        stop_pacer();
         
         // Unregister playback callback
         if (m_callbacks_registered) {
@@ -109,6 +384,10 @@ public:
             } catch(...) {}
         }
         
+        release_overlay();
+        release_back_buffer();
+        g_exporter.release(this);
+        
         // Release visualization stream
         if (m_vis_stream.is_valid()) {
             m_vis_stream.release();
@@ -133,11 +412,13 @@ public:
         SetWindowLongPtr(m_hwnd, GWLP_USERDATA, (LONG_PTR)this);
         SetWindowLongPtr(m_hwnd, GWLP_WNDPROC, (LONG_PTR)WindowProc);
         
-        // Get colors
-        m_clr_background = m_callback->query_std_color(ui_color_background);
-        m_clr_bar = m_callback->query_std_color(ui_color_text);
-        m_clr_played = m_callback->query_std_color(ui_color_selection);
-        m_clr_position = m_callback->query_std_color(ui_color_highlight);
+        // Get colors and font
+        update_colors();
+        
+        // Initial WM_SIZE went to the original window procedure
+        RECT rc;
+        GetClientRect(m_hwnd, &rc);
+        update_layout(rc.right, rc.bottom);
         
         // Create visualization stream
         try {
@@ -159,6 +440,119 @@ public:
         // Start timer
         m_timer = SetTimer(m_hwnd, 1, 16, TimerProc);
         SetWindowLongPtr(m_hwnd, GWLP_USERDATA, (LONG_PTR)this);
+        
+        start_pacer();
+    }
+    
+    typedef HRESULT (WINAPI *dwm_flush_t)();
+    
+    static dwm_flush_t query_dwm_flush() {
+        // dwmapi.dll is absent on XP; DwmFlush fails while composition is off.
+        // Loaded once and kept for the life of the process.
+        static HMODULE dwm = LoadLibrary(L"dwmapi.dll");
+        static dwm_flush_t dwm_flush = dwm ? (dwm_flush_t)GetProcAddress(dwm, "DwmFlush") : NULL;
+        return dwm_flush;
+    }
+    
+    static DWORD WINAPI PacerProc(LPVOID param) {
+        spectrum_seekbar_v10* p_this = reinterpret_cast<spectrum_seekbar_v10*>(param);
+        HWND hwnd = p_this->m_hwnd;
+        dwm_flush_t dwm_flush = query_dwm_flush();
+        
+        while (!p_this->m_pacer_stop) {
+            // Nothing to present while hidden (inactive tab, panel collapsed) or minimized
+            if (!IsWindowVisible(hwnd) || IsIconic(GetAncestor(hwnd, GA_ROOT))) {
+                Sleep(50);
+                continue;
+            }
+            
+            // Blocks until the next composition pass, i.e. once per display refresh - but
+            // returns at once when there is nothing to compose, so never spin on it
+            double start = wall_time();
+            if (!dwm_flush || FAILED(dwm_flush())) Sleep(16);
+            else if (wall_time() - start < 0.002) Sleep(1);
+            InvalidateRect(hwnd, NULL, FALSE);
+        }
+        return 0;
+    }
+    
+    void start_pacer() {
+        m_pacer_stop = 0;
+        m_pacer = CreateThread(NULL, 0, PacerProc, this, 0, NULL);
+    }
+    
+    void stop_pacer() {
+        if (!m_pacer) return;
+        
+        InterlockedExchange(&m_pacer_stop, 1);
+        WaitForSingleObject(m_pacer, INFINITE);
+        CloseHandle(m_pacer);
+        m_pacer = NULL;
+    }
+    
+    void update_colors() {
+        m_clr_background = m_callback->query_std_color(ui_color_background);
+        m_clr_bar = m_callback->query_std_color(ui_color_text);
+        m_clr_played = m_callback->query_std_color(ui_color_selection);
+        m_clr_position = m_callback->query_std_color(ui_color_highlight);
+        
+        // Font is owned by the host - never delete it
+        m_font = m_callback->query_font_ex(ui_font_default);
+        if (!m_font) m_font = (HFONT)GetStockObject(DEFAULT_GUI_FONT);
+    }
+    
+    const track_info& resolve_track(metadb_handle_ptr track) {
+        for (int i = 0; i < TRACK_CACHE_SIZE; i++) {
+            if (m_track_cache[i].handle.is_valid() && m_track_cache[i].handle == track) {
+                return m_track_cache[i];
+            }
+        }
+        
+        // Round-robin replacement; the current and prefetched tracks are the newest entries
+        track_info& entry = m_track_cache[m_track_cache_next];
+        m_track_cache_next = (m_track_cache_next + 1) % TRACK_CACHE_SIZE;
+        
+        entry.handle = track;
+        entry.length = 0;
+        entry.bitrate = 0;
+        
+        metadb_info_container::ptr info;
+        if (track->get_info_ref(info)) {
+            entry.length = info->info().get_length();
+            entry.bitrate = info->info().info_get_bitrate();
+        }
+        if (entry.length <= 0) {
+            entry.length = track->get_length();
+        }
+        
+        return entry;
+    }
+    
+    void forget_track(metadb_handle_ptr track) {
+        for (int i = 0; i < TRACK_CACHE_SIZE; i++) {
+            if (m_track_cache[i].handle == track) m_track_cache[i].handle.release();
+        }
+    }
+    
+    void prefetch_next_track() {
+        static_api_ptr_t<playlist_manager> pm;
+        metadb_handle_ptr next;
+        
+        if (pm->queue_get_count() > 0) {
+            // Queued items play first
+            pfc::list_t<t_playback_queue_item> queue;
+            pm->queue_get_contents(queue);
+            next = queue[0].m_handle;
+        } else if (pm->playback_order_get_active() == 0) {
+            // Default order - the next item of the playing playlist; shuffle/random can't be predicted
+            t_size playlist, item;
+            if (pm->get_playing_item_location(&playlist, &item) &&
+                item + 1 < pm->playlist_get_item_count(playlist)) {
+                pm->playlist_get_item_handle(next, playlist, item + 1);
+            }
+        }
+        
+        if (next.is_valid()) resolve_track(next);
     }
     
     void update_playback_state() {
@@ -169,21 +563,12 @@ public:
             // Method 1: Try to get length from playback control
             m_track_length = pc->playback_get_length();
             
-            // Method 2: If that fails, get from current track metadata
+            // Method 2: If that fails, use the cached track info
             if (m_track_length <= 0) {
                 metadb_handle_ptr track;
                 if (pc->get_now_playing(track)) {
                     m_current_track = track;
-                    
-                    file_info_impl info;
-                    if (track->get_info(info)) {
-                        m_track_length = info.get_length();
-                    }
-                    
-                    // Method 3: Try alternate method
-                    if (m_track_length <= 0) {
-                        m_track_length = track->get_length();
-                    }
+                    m_track_length = resolve_track(track).length;
                 }
             }
             
@@ -198,19 +583,47 @@ public:
     
     HWND get_wnd() { return m_hwnd; }
     
+    bool load_configuration(ui_element_config::ptr config) {
+        if (!config.is_valid() || config->get_data_size() < 8) return false;
+        
+        const t_uint8* data = (const t_uint8*)config->get_data();
+        m_visualization_style = *(int*)data;
+        m_channel_mode = *(int*)(data + 4);
+        
+        // Settings added after V10.0.0 - older configurations simply omit them
+        if (config->get_data_size() >= 12) {
+            m_latency_ms = *(int*)(data + 8);
+        }
+        if (config->get_data_size() >= 16) {
+            m_text_format = *(int*)(data + 12);
+        }
+        if (config->get_data_size() >= 24) {
+            m_beat_accents = *(int*)(data + 16);
+            m_show_bpm = *(int*)(data + 20);
+        }
+        if (config->get_data_size() >= 28) {
+            m_export_shared = *(int*)(data + 24);
+        }
+        
+        // Validate loaded values
+        if (m_visualization_style < 0 || m_visualization_style >= STYLE_COUNT)
+            m_visualization_style = STYLE_BARS;
+        if (m_channel_mode < 0 || m_channel_mode >= CHANNEL_COUNT)
+            m_channel_mode = CHANNEL_MONO;
+        if (m_latency_ms < 0 || m_latency_ms > 1000)
+            m_latency_ms = 0;
+        if (m_text_format < 0 || m_text_format >= TEXT_FORMAT_COUNT)
+            m_text_format = TEXT_ELAPSED;
+        m_beat_accents = m_beat_accents ? 1 : 0;
+        m_show_bpm = m_show_bpm ? 1 : 0;
+        m_export_shared = m_export_shared ? 1 : 0;
+        
+        return true;
+    }
+    
     void set_configuration(ui_element_config::ptr config) {
         // Load configuration if available
-        if (config.is_valid() && config->get_data_size() >= 8) {
-            const t_uint8* data = (const t_uint8*)config->get_data();
-            m_visualization_style = *(int*)data;
-            m_channel_mode = *(int*)(data + 4);
-            
-            // Validate loaded values
-            if (m_visualization_style < 0 || m_visualization_style >= STYLE_COUNT)
-                m_visualization_style = STYLE_BARS;
-            if (m_channel_mode < 0 || m_channel_mode >= CHANNEL_COUNT)
-                m_channel_mode = CHANNEL_MONO;
-                
+        if (load_configuration(config)) {
             // Refresh display
             if (m_hwnd) InvalidateRect(m_hwnd, NULL, FALSE);
         }
@@ -221,12 +634,28 @@ public:
         ui_element_config_builder builder;
         builder << m_visualization_style;
         builder << m_channel_mode;
+        builder << m_latency_ms;
+        builder << m_text_format;
+        builder << m_beat_accents;
+        builder << m_show_bpm;
+        builder << m_export_shared;
         return builder.finish(g_get_guid());
     }
     
     GUID get_guid() { return g_get_guid(); }
     GUID get_subclass() { return g_get_subclass(); }
     
+    void notify(const GUID & p_what, t_size p_param1, const void * p_param2, t_size p_param2size) {
+        if (p_what == ui_element_notify_colors_changed || p_what == ui_element_notify_font_changed) {
+            update_colors();
+            // Overlay height follows the font; the bitmap holds the old font and colour key
+            if (m_hwnd) {
+                update_layout(m_layout.width, m_layout.height);
+                InvalidateRect(m_hwnd, NULL, FALSE);
+            }
+        }
+    }
+    
     static GUID g_get_guid() {
         // {C1B2A3D4-E5F6-7890-ABCD-EF1234567890}
         static const GUID guid = 
@@ -243,6 +672,9 @@ public:
         HMENU menu = CreatePopupMenu();
         HMENU styleMenu = CreatePopupMenu();
         HMENU channelMenu = CreatePopupMenu();
+        HMENU latencyMenu = CreatePopupMenu();
+        HMENU textMenu = CreatePopupMenu();
+        HMENU beatMenu = CreatePopupMenu();
         
         // Style submenu
         AppendMenu(styleMenu, MF_STRING | (m_visualization_style == STYLE_LINES ? MF_CHECKED : 0), 1001, L"Lines");
@@ -254,9 +686,32 @@ public:
         AppendMenu(channelMenu, MF_STRING | (m_channel_mode == CHANNEL_MONO ? MF_CHECKED : 0), 2001, L"Mixed (Mono)");
         AppendMenu(channelMenu, MF_STRING | (m_channel_mode == CHANNEL_STEREO ? MF_CHECKED : 0), 2002, L"Stereo (Mirrored)");
         
+        // Latency submenu - delays the visuals to match output device latency
+        static const int latency_values[] = {0, 20, 50, 100, 150, 250};
+        static const WCHAR* latency_names[] = {L"Off", L"20 ms", L"50 ms", L"100 ms", L"150 ms", L"250 ms"};
+        for (int i = 0; i < 6; i++) {
+            AppendMenu(latencyMenu, MF_STRING | (m_latency_ms == latency_values[i] ? MF_CHECKED : 0), 3001 + i, latency_names[i]);
+        }
+        
+        // Overlay text submenu
+        AppendMenu(textMenu, MF_STRING | (m_text_format == TEXT_ELAPSED ? MF_CHECKED : 0), 4001, L"Elapsed / Total");
+        AppendMenu(textMenu, MF_STRING | (m_text_format == TEXT_REMAINING ? MF_CHECKED : 0), 4002, L"Remaining / Total");
+        AppendMenu(textMenu, MF_STRING | (m_text_format == TEXT_SAMPLES ? MF_CHECKED : 0), 4003, L"Sample Position");
+        AppendMenu(textMenu, MF_STRING | (m_text_format == TEXT_BITRATE ? MF_CHECKED : 0), 4004, L"Elapsed + Bitrate");
+        
+        // Beat detection submenu
+        AppendMenu(beatMenu, MF_STRING | (m_beat_accents ? MF_CHECKED : 0), 5001, L"Visual Accents");
+        AppendMenu(beatMenu, MF_STRING | (m_show_bpm ? MF_CHECKED : 0), 5002, L"Show BPM");
+        
         // Main menu
         AppendMenu(menu, MF_POPUP, (UINT_PTR)styleMenu, L"Visualization Style");
         AppendMenu(menu, MF_POPUP, (UINT_PTR)channelMenu, L"Channel Mode");
+        AppendMenu(menu, MF_POPUP, (UINT_PTR)latencyMenu, L"Latency Compensation");
+        AppendMenu(menu, MF_POPUP, (UINT_PTR)textMenu, L"Overlay Text");
+        AppendMenu(menu, MF_POPUP, (UINT_PTR)beatMenu, L"Beat Detection");
+        AppendMenu(menu, MF_SEPARATOR, 0, NULL);
+        AppendMenu(menu, MF_STRING | (m_export_shared ? MF_CHECKED : 0), 6001, L"Export Frames (Shared Memory)");
+        AppendMenu(menu, MF_STRING | (m_trace.is_open() ? MF_CHECKED : 0), 9001, L"Record Trace");
         
         int cmd = TrackPopupMenu(menu, TPM_RETURNCMD | TPM_LEFTBUTTON, pt.x, pt.y, 0, m_hwnd, NULL);
         
@@ -270,8 +725,37 @@ public:
             InvalidateRect(m_hwnd, NULL, FALSE);
             // Save configuration
             m_callback->on_min_max_info_change();
+        } else if (cmd >= 3001 && cmd <= 3006) {
+            m_latency_ms = latency_values[cmd - 3001];
+            // Frame grid is anchored to the compensated time - rebuild it
+            reset_frames();
+            // Save configuration
+            m_callback->on_min_max_info_change();
+        } else if (cmd >= 4001 && cmd <= 4004) {
+            m_text_format = cmd - 4001;
+            InvalidateRect(m_hwnd, NULL, FALSE);
+            // Save configuration
+            m_callback->on_min_max_info_change();
+        } else if (cmd == 5001) {
+            m_beat_accents = !m_beat_accents;
+            // Save configuration
+            m_callback->on_min_max_info_change();
+        } else if (cmd == 5002) {
+            m_show_bpm = !m_show_bpm;
+            InvalidateRect(m_hwnd, NULL, FALSE);
+            // Save configuration
+            m_callback->on_min_max_info_change();
+        } else if (cmd == 6001) {
+            m_export_shared = !m_export_shared;
+            // Save configuration
+            m_callback->on_min_max_info_change();
+        } else if (cmd == 9001) {
+            toggle_trace();
         }
         
+        DestroyMenu(beatMenu);
+        DestroyMenu(textMenu);
+        DestroyMenu(latencyMenu);
         DestroyMenu(channelMenu);
         DestroyMenu(styleMenu);
         DestroyMenu(menu);
@@ -281,7 +765,8 @@ public:
         spectrum_seekbar_v10* p_this = reinterpret_cast<spectrum_seekbar_v10*>(GetWindowLongPtr(hwnd, GWLP_USERDATA));
         if (p_this) {
             p_this->update_spectrum();
-            InvalidateRect(hwnd, NULL, FALSE);
+            // Without the pacer thread paints fall back to the timer cadence
+            if (!p_this->m_pacer) InvalidateRect(hwnd, NULL, FALSE);
         }
     }
     
@@ -297,6 +782,19 @@ public:
             case WM_ERASEBKGND:
                 return 1;
                 
+            case WM_SIZE:
+                p_this->update_layout(LOWORD(lParam), HIWORD(lParam));
+                return 0;
+                
+            case WM_DPICHANGED_AFTERPARENT:
+                {
+                    RECT rc;
+                    GetClientRect(hwnd, &rc);
+                    p_this->update_layout(rc.right, rc.bottom);
+                    InvalidateRect(hwnd, NULL, FALSE);
+                    return 0;
+                }
+                
             case WM_LBUTTONDOWN:
                 p_this->on_lbutton_down(GET_X_LPARAM(lParam));
                 return 0;
@@ -334,12 +832,17 @@ public:
                     KillTimer(hwnd, p_this->m_timer);
                     p_this->m_timer = 0;
                 }
+                p_this->stop_pacer();
                 if (p_this->m_callbacks_registered) {
                     try {
                         static_api_ptr_t<play_callback_manager>()->unregister_callback(p_this);
                         p_this->m_callbacks_registered = false;
                     } catch(...) {}
                 }
+                p_this->release_overlay();
+                p_this->release_back_buffer();
+                p_this->m_trace.close();
+                g_exporter.release(p_this);
                 // Clear the window pointer to prevent double-cleanup
                 p_this->m_hwnd = NULL;
                 return 0;
@@ -351,14 +854,13 @@ public:
     void on_lbutton_down(int x) {
         if (!m_is_playing || m_track_length <= 0) return;
         
-        RECT rc;
-        GetClientRect(m_hwnd, &rc);
+        if (m_layout.width <= 0) return;
         
         m_seeking = true;
         SetCapture(m_hwnd);
         
         // Calculate seek position
-        double ratio = (double)x / rc.right;
+        double ratio = (double)x / m_layout.width;
         if (ratio < 0) ratio = 0;
         if (ratio > 1) ratio = 1;
         
@@ -371,140 +873,259 @@ public:
         m_playback_position = seek_position;
     }
     
+    static double wall_time() {
+        LARGE_INTEGER counter, frequency;
+        QueryPerformanceCounter(&counter);
+        QueryPerformanceFrequency(&frequency);
+        return (double)counter.QuadPart / (double)frequency.QuadPart;
+    }
+    
     void update_spectrum() {
-        if (!m_vis_stream.is_valid()) {
-            for (int i = 0; i < NUM_BARS; i++) {
-                m_bars[i] *= 0.9f;
-                if (m_bars[i] < 0.01f) m_bars[i] = 0;
-            }
+        double time = 0;
+        bool has_time = m_vis_stream.is_valid() && m_vis_stream->get_absolute_time(time);
+        
+        // Never let a queued cross-fade wait on a timeline that doesn't reach it
+        if (m_handoff_pending && wall_time() > m_handoff_deadline + 0.25) apply_handoff(time);
+        
+        if (!has_time && m_handoff_pending && wall_time() < m_handoff_deadline) {
+            // The output device is still playing the last latency_ms of audio -
+            // hold the last frame until then rather than fading out early
+            m_trace.write_event(TRACE_HOLD, wall_time(), false, 0);
             return;
         }
+        m_trace.write_event(TRACE_TICK, wall_time(), has_time, time);
         
-        double time = 0;
-        if (!m_vis_stream->get_absolute_time(time)) {
-            for (int i = 0; i < NUM_BARS; i++) {
-                m_bars[i] *= 0.9f;
-                if (m_bars[i] < 0.01f) m_bars[i] = 0;
-            }
+        if (!has_time) {
+            if (m_handoff_pending) apply_handoff(0);
+            
+            m_analyzer.decay();
+            m_beat.decay();
+            reset_frames();
+            publish_frame(0);
             return;
         }
         
-        audio_chunk_impl chunk;
-        if (m_vis_stream->get_spectrum_absolute(chunk, time, 1024)) {
-            process_spectrum(chunk);
-        } else {
-            m_vis_stream->make_fake_spectrum_absolute(chunk, time, 1024);
-            if (chunk.get_sample_count() > 0) {
-                process_spectrum(chunk);
-            }
+        advance_frames(time);
+    }
+    
+    void advance_frames(double time) {
+        // Analyse every grid frame up to the first one past the presentation
+        // time, so on_paint always has a pair of frames to interpolate between
+        const int rate = spectrum_frame_history::ANALYSIS_RATE;
+        double target = time - m_latency_ms / 1000.0;
+        t_int64 last_frame = (t_int64)floor(target * rate) + 1;
+        
+        if (m_frames.count() == 0 || m_next_frame > last_frame + 1 ||
+            m_next_frame < last_frame - spectrum_frame_history::FRAME_HISTORY) {
+            // Start, seek or stall - restart the grid just behind the target
+            reset_frames();
+            m_next_frame = last_frame - 1;
         }
+        
+        while (m_next_frame <= last_frame) {
+            double frame_time = (double)m_next_frame / rate;
+            
+            if (m_handoff_pending && frame_time >= m_handoff_time) apply_handoff(frame_time);
+            
+            // Frames ahead of the playback time may not be buffered yet - wait
+            // for the data rather than filling the grid with fake spectrum
+            if (!analyze_frame(frame_time, frame_time <= time)) break;
+            
+            m_frames.push(frame_time, m_analyzer);
+            publish_frame(frame_time);
+            m_next_frame++;
+        }
+    }
+    
+    void reset_frames() {
+        if (m_frames.count() == 0) return;
+        m_trace.write_event(TRACE_RESET, wall_time(), false, 0);
+        m_frames.reset();
+    }
+    
+    bool analyze_frame(double time, bool allow_fake) {
+        if (m_vis_stream->get_spectrum_absolute(m_chunk, time, 1024)) {
+            m_sample_rate = m_chunk.get_sample_rate();
+            process_spectrum(time, m_chunk);
+            return true;
+        }
+        
+        if (!allow_fake) return false;
+        
+        m_vis_stream->make_fake_spectrum_absolute(m_chunk, time, 1024);
+        process_spectrum(time, m_chunk);
+        return true;
     }
     
-    void process_spectrum(const audio_chunk & chunk) {
+    void process_spectrum(double time, const audio_chunk & chunk) {
         unsigned samples = chunk.get_sample_count();
         unsigned channels = chunk.get_channels();
         
-        if (samples == 0 || channels == 0) return;
+        m_trace.write_chunk(time, chunk.get_sample_rate(), channels, samples, chunk.get_data());
+        m_analyzer.process(chunk.get_data(), samples, channels);
+        m_beat.process(m_analyzer.levels());
+    }
+    
+    void publish_frame(double time) {
+        float values[spectrum_analyzer::FRAME_FLOATS];
+        m_analyzer.capture(values);
         
-        const audio_sample * data = chunk.get_data();
+        spectrum_export_frame frame;
+        frame.flags = (m_is_playing ? SPECTRUM_EXPORT_PLAYING : 0) | (m_beat.onset() ? SPECTRUM_EXPORT_ONSET : 0);
+        frame.time = time;
+        frame.track_position = m_playback_position;
+        frame.track_length = m_track_length;
+        frame.bpm = m_beat.bpm();
+        frame.accent = m_beat.accent();
+        memcpy(frame.bars, values + spectrum_analyzer::FRAME_BARS, sizeof(frame.bars));
+        memcpy(frame.peaks, values + spectrum_analyzer::FRAME_PEAKS, sizeof(frame.peaks));
+        memcpy(frame.bars_left, values + spectrum_analyzer::FRAME_LEFT, sizeof(frame.bars_left));
+        memcpy(frame.bars_right, values + spectrum_analyzer::FRAME_RIGHT, sizeof(frame.bars_right));
         
-        for (int bar = 0; bar < NUM_BARS; bar++) {
-            float freq_start = powf(2.0f, (float)bar / 4.0f);
-            float freq_end = powf(2.0f, (float)(bar + 1) / 4.0f);
-            
-            int bin_start = (int)(freq_start * samples / 512.0f);
-            int bin_end = (int)(freq_end * samples / 512.0f);
-            
-            if (bin_start >= (int)samples) bin_start = samples - 1;
-            if (bin_end > (int)samples) bin_end = samples;
-            if (bin_start >= bin_end) bin_end = bin_start + 1;
-            
-            float sum = 0;
-            int count = 0;
-            
-            float sum_left = 0, sum_right = 0;
-            
-            for (int i = bin_start; i < bin_end && i < (int)samples; i++) {
-                if (channels == 1) {
-                    float val = data[i];
-                    sum += val * val;
-                    sum_left += val * val;
-                    sum_right += val * val;
-                } else if (channels >= 2) {
-                    float val_left = data[i * channels];
-                    float val_right = data[i * channels + 1];
-                    sum += (val_left * val_left + val_right * val_right) / 2;
-                    sum_left += val_left * val_left;
-                    sum_right += val_right * val_right;
-                }
-                count++;
-            }
+        g_exporter.publish(this, frame, m_export_shared != 0);
+    }
+    
+    void update_display() {
+        // Sample the clock at presentation rather than at the timer tick
+        double time = m_frames.newest_time();
+        double stream_time = 0;
+        bool has_time = m_vis_stream.is_valid() && m_vis_stream->get_absolute_time(stream_time);
+        if (has_time) {
+            time = stream_time - m_latency_ms / 1000.0;
             
-            if (count > 0) {
-                // Combined channel
-                float magnitude = sqrtf(sum / count);
-                float db = 20.0f * log10f(magnitude + 1e-10f);
-                float normalized = (db + 60.0f) / 60.0f;
-                if (normalized < 0) normalized = 0;
-                if (normalized > 1) normalized = 1;
-                
-                float target = normalized;
-                if (target > m_bars[bar]) {
-                    m_bars[bar] = m_bars[bar] + (target - m_bars[bar]) * 0.5f;
-                } else {
-                    m_bars[bar] = m_bars[bar] * 0.9f;
-                }
-                
-                // Left channel
-                float magnitude_left = sqrtf(sum_left / count);
-                float db_left = 20.0f * log10f(magnitude_left + 1e-10f);
-                float normalized_left = (db_left + 60.0f) / 60.0f;
-                if (normalized_left < 0) normalized_left = 0;
-                if (normalized_left > 1) normalized_left = 1;
-                
-                if (normalized_left > m_bars_left[bar]) {
-                    m_bars_left[bar] = m_bars_left[bar] + (normalized_left - m_bars_left[bar]) * 0.5f;
-                } else {
-                    m_bars_left[bar] = m_bars_left[bar] * 0.9f;
-                }
-                
-                // Right channel
-                float magnitude_right = sqrtf(sum_right / count);
-                float db_right = 20.0f * log10f(magnitude_right + 1e-10f);
-                float normalized_right = (db_right + 60.0f) / 60.0f;
-                if (normalized_right < 0) normalized_right = 0;
-                if (normalized_right > 1) normalized_right = 1;
-                
-                if (normalized_right > m_bars_right[bar]) {
-                    m_bars_right[bar] = m_bars_right[bar] + (normalized_right - m_bars_right[bar]) * 0.5f;
-                } else {
-                    m_bars_right[bar] = m_bars_right[bar] * 0.9f;
-                }
-                
-                if (m_bars[bar] > m_peaks[bar]) {
-                    m_peaks[bar] = m_bars[bar];
-                } else {
-                    m_peaks[bar] *= 0.98f;
-                }
-            }
+            // Paints at the display rate can get ahead of the analysis timer - catch up
+            // so there is always a later frame to interpolate towards
+            if (m_frames.count() > 0 && time > m_frames.newest_time()) advance_frames(stream_time);
+        }
+        m_trace.write_event(TRACE_PAINT, wall_time(), has_time, time);
+        
+        if (!m_frames.interpolate(time, m_display)) {
+            // No timeline (stopped or no stream) - show the decaying state as is
+            m_analyzer.capture(m_display);
+        }
+    }
+    
+    void toggle_trace() {
+        if (m_trace.is_open()) {
+            m_trace.close();
+            console::formatter() << "Spectrum Seekbar: trace recording stopped";
+            return;
+        }
+        
+        // Profile path comes back as a file:// URL
+        const char* profile = core_api::get_profile_path();
+        if (strncmp(profile, "file://", 7) == 0) profile += 7;
+        pfc::string8 path = profile;
+        path.add_string("\\spectrum_seekbar_trace.bin");
+        
+        m_trace.open(_wfopen(pfc::stringcvt::string_wide_from_utf8(path), L"wb"));
+        if (m_trace.is_open()) {
+            console::formatter() << "Spectrum Seekbar: recording trace to " << path;
+        } else {
+            console::formatter() << "Spectrum Seekbar: could not create " << path;
+        }
+    }
+    
+    static COLORREF blend_color(COLORREF from, COLORREF to, float amount) {
+        return RGB(
+            GetRValue(from) + (int)((GetRValue(to) - GetRValue(from)) * amount),
+            GetGValue(from) + (int)((GetGValue(to) - GetGValue(from)) * amount),
+            GetBValue(from) + (int)((GetBValue(to) - GetBValue(from)) * amount)
+        );
+    }
+    
+    static UINT query_dpi(HWND hwnd) {
+        // GetDpiForWindow is per-monitor aware but only exists on Windows 10 1607+
+        typedef UINT (WINAPI *get_dpi_for_window_t)(HWND);
+        static get_dpi_for_window_t get_dpi_for_window =
+            (get_dpi_for_window_t)GetProcAddress(GetModuleHandle(L"user32.dll"), "GetDpiForWindow");
+        
+        if (get_dpi_for_window) {
+            UINT dpi = get_dpi_for_window(hwnd);
+            if (dpi) return dpi;
+        }
+        
+        HDC hdc = GetDC(hwnd);
+        int dpi = GetDeviceCaps(hdc, LOGPIXELSX);
+        ReleaseDC(hwnd, hdc);
+        return dpi > 0 ? dpi : USER_DEFAULT_SCREEN_DPI;
+    }
+    
+    int scale(int value) const { return MulDiv(value, m_layout.dpi, USER_DEFAULT_SCREEN_DPI); }
+    
+    void release_back_buffer() {
+        if (!m_back_dc) return;
+        
+        SelectObject(m_back_dc, m_back_old_bmp);
+        DeleteObject(m_back_bmp);
+        DeleteDC(m_back_dc);
+        
+        m_back_dc = NULL;
+        m_back_bmp = NULL;
+    }
+    
+    void update_layout(int width, int height) {
+        if (!m_hwnd) return;
+        
+        m_layout.width = width;
+        m_layout.height = height;
+        m_layout.center_y = height / 2;
+        m_layout.dpi = query_dpi(m_hwnd);
+        
+        for (int i = 0; i < NUM_BARS; i++) {
+            m_layout.bar_left[i] = MulDiv(i, width, NUM_BARS);
+            m_layout.bar_right[i] = MulDiv(i + 1, width, NUM_BARS);
+            m_layout.bar_center[i] = MulDiv(2 * i + 1, width, 2 * NUM_BARS);
         }
+        
+        m_layout.bar_inset = scale(1);
+        m_layout.block_pitch = scale(8);
+        m_layout.block_size = scale(4);
+        m_layout.block_gap = scale(2);
+        m_layout.block_inset = scale(2);
+        m_layout.dot_radius = scale(3);
+        m_layout.line_width = scale(2);
+        m_layout.position_width = scale(3);
+        m_layout.progress_width = scale(4);
+        m_layout.progress_y = height - scale(2);
+        
+        m_layout.overlay_top = scale(10);
+        m_layout.overlay_margin = scale(10);
+        m_layout.overlay_height = scale(20);
+        
+        // Never clip the overlay font, whatever size the host hands us
+        HDC hdc = GetDC(m_hwnd);
+        HGDIOBJ oldFont = SelectObject(hdc, m_font);
+        SIZE text_size;
+        if (GetTextExtentPoint32(hdc, L"0:00", 4, &text_size) && text_size.cy > m_layout.overlay_height) {
+            m_layout.overlay_height = text_size.cy;
+        }
+        SelectObject(hdc, oldFont);
+        
+        // Back buffer follows the client size; the overlay strip is rebuilt lazily
+        release_back_buffer();
+        if (width > 0 && height > 0) {
+            m_back_dc = CreateCompatibleDC(hdc);
+            m_back_bmp = CreateCompatibleBitmap(hdc, width, height);
+            m_back_old_bmp = SelectObject(m_back_dc, m_back_bmp);
+        }
+        ReleaseDC(m_hwnd, hdc);
+        
+        release_overlay();
     }
     
     void draw_lines(HDC hdc, const RECT& rc, float* bars, COLORREF color) {
         if (NUM_BARS < 2) return;
         
-        HPEN linePen = CreatePen(PS_SOLID, 2, color);
+        HPEN linePen = CreatePen(PS_SOLID, m_layout.line_width, color);
         HPEN oldPen = (HPEN)SelectObject(hdc, linePen);
         
-        int bar_width = rc.right / NUM_BARS;
-        int first_x = bar_width / 2;
         int first_y = rc.bottom - (int)(bars[0] * rc.bottom * 0.9f);
-        MoveToEx(hdc, first_x, first_y, NULL);
+        MoveToEx(hdc, m_layout.bar_center[0], first_y, NULL);
         
         for (int i = 1; i < NUM_BARS; i++) {
-            int x = i * bar_width + bar_width / 2;
             int y = rc.bottom - (int)(bars[i] * rc.bottom * 0.9f);
-            LineTo(hdc, x, y);
+            LineTo(hdc, m_layout.bar_center[i], y);
         }
         
         SelectObject(hdc, oldPen);
@@ -512,15 +1133,14 @@ public:
     }
     
     void draw_bars(HDC hdc, const RECT& rc, float* bars, COLORREF color) {
-        int bar_width = rc.right / NUM_BARS;
         HBRUSH barBrush = CreateSolidBrush(color);
         
         for (int i = 0; i < NUM_BARS; i++) {
-            int x = i * bar_width;
             int bar_height = (int)(bars[i] * rc.bottom * 0.9f);
             int y = rc.bottom - bar_height;
             
-            RECT barRect = {x + 1, y, x + bar_width - 1, rc.bottom};
+            RECT barRect = {m_layout.bar_left[i] + m_layout.bar_inset, y,
+                            m_layout.bar_right[i] - m_layout.bar_inset, rc.bottom};
             FillRect(hdc, &barRect, barBrush);
         }
         
@@ -528,19 +1148,20 @@ public:
     }
     
     void draw_blocks(HDC hdc, const RECT& rc, float* bars, COLORREF color) {
-        int bar_width = rc.right / NUM_BARS;
         HBRUSH blockBrush = CreateSolidBrush(color);
         
         for (int i = 0; i < NUM_BARS; i++) {
-            int x = i * bar_width;
             int bar_height = (int)(bars[i] * rc.bottom * 0.9f);
-            int num_blocks = (bar_height / 8) + 1;
+            int num_blocks = (bar_height / m_layout.block_pitch) + 1;
             
             for (int j = 0; j < num_blocks; j++) {
-                int block_y = rc.bottom - (j + 1) * 8;
+                int block_y = rc.bottom - (j + 1) * m_layout.block_pitch;
                 if (block_y < rc.bottom - bar_height) break;
                 
-                RECT blockRect = {x + 2, block_y - 6, x + bar_width - 2, block_y - 2};
+                RECT blockRect = {m_layout.bar_left[i] + m_layout.block_inset,
+                                  block_y - m_layout.block_gap - m_layout.block_size,
+                                  m_layout.bar_right[i] - m_layout.block_inset,
+                                  block_y - m_layout.block_gap};
                 FillRect(hdc, &blockRect, blockBrush);
             }
         }
@@ -549,46 +1170,48 @@ public:
     }
     
     void draw_dots(HDC hdc, const RECT& rc, float* bars, COLORREF color) {
-        int bar_width = rc.right / NUM_BARS;
         HBRUSH dotBrush = CreateSolidBrush(color);
+        int r = m_layout.dot_radius;
         
         for (int i = 0; i < NUM_BARS; i++) {
-            int x = i * bar_width + bar_width / 2;
+            int x = m_layout.bar_center[i];
             int y = rc.bottom - (int)(bars[i] * rc.bottom * 0.9f);
             
-            RECT dotRect = {x - 3, y - 3, x + 3, y + 3};
+            RECT dotRect = {x - r, y - r, x + r, y + r};
             FillRect(hdc, &dotRect, dotBrush);
         }
         
         DeleteObject(dotBrush);
     }
     
-    void draw_stereo_mirrored(HDC hdc, const RECT& rc) {
-        int center_y = rc.bottom / 2;
+    void draw_stereo_mirrored(HDC hdc, const RECT& rc, COLORREF color) {
+        float* bars_left = m_display + spectrum_analyzer::FRAME_LEFT;
+        float* bars_right = m_display + spectrum_analyzer::FRAME_RIGHT;
+        
+        int center_y = m_layout.center_y;
         RECT top_rc = {rc.left, rc.top, rc.right, center_y};
-        RECT bottom_rc = {rc.left, center_y, rc.right, rc.bottom};
         
         // Draw top half (left channel)
         switch(m_visualization_style) {
             case STYLE_LINES:
-                draw_lines(hdc, top_rc, m_bars_left, m_clr_bar);
+                draw_lines(hdc, top_rc, bars_left, color);
                 break;
             case STYLE_BARS:
-                draw_bars(hdc, top_rc, m_bars_left, m_clr_bar);
+                draw_bars(hdc, top_rc, bars_left, color);
                 break;
             case STYLE_BLOCKS:
-                draw_blocks(hdc, top_rc, m_bars_left, m_clr_bar);
+                draw_blocks(hdc, top_rc, bars_left, color);
                 break;
             case STYLE_DOTS:
-                draw_dots(hdc, top_rc, m_bars_left, m_clr_bar);
+                draw_dots(hdc, top_rc, bars_left, color);
                 break;
         }
         
         // Draw bottom half (right channel) - flip the rect coordinate system
         COLORREF right_color = RGB(
-            GetRValue(m_clr_bar) * 3 / 4,
-            GetGValue(m_clr_bar) * 3 / 4,
-            GetBValue(m_clr_bar) * 3 / 4
+            GetRValue(color) * 3 / 4,
+            GetGValue(color) * 3 / 4,
+            GetBValue(color) * 3 / 4
         );
         
         // For bottom half, we need to draw from center downward
@@ -596,18 +1219,15 @@ public:
             case STYLE_LINES:
                 {
                     if (NUM_BARS >= 2) {
-                        HPEN linePen = CreatePen(PS_SOLID, 2, right_color);
+                        HPEN linePen = CreatePen(PS_SOLID, m_layout.line_width, right_color);
                         HPEN oldPen = (HPEN)SelectObject(hdc, linePen);
                         
-                        int bar_width = rc.right / NUM_BARS;
-                        int first_x = bar_width / 2;
-                        int first_y = center_y + (int)(m_bars_right[0] * center_y * 0.8f);
-                        MoveToEx(hdc, first_x, first_y, NULL);
+                        int first_y = center_y + (int)(bars_right[0] * center_y * 0.8f);
+                        MoveToEx(hdc, m_layout.bar_center[0], first_y, NULL);
                         
                         for (int i = 1; i < NUM_BARS; i++) {
-                            int x = i * bar_width + bar_width / 2;
-                            int y = center_y + (int)(m_bars_right[i] * center_y * 0.8f);
-                            LineTo(hdc, x, y);
+                            int y = center_y + (int)(bars_right[i] * center_y * 0.8f);
+                            LineTo(hdc, m_layout.bar_center[i], y);
                         }
                         
                         SelectObject(hdc, oldPen);
@@ -617,14 +1237,13 @@ public:
                 break;
             case STYLE_BARS:
                 {
-                    int bar_width = rc.right / NUM_BARS;
                     HBRUSH barBrush = CreateSolidBrush(right_color);
                     
                     for (int i = 0; i < NUM_BARS; i++) {
-                        int x = i * bar_width;
-                        int bar_height = (int)(m_bars_right[i] * center_y * 0.8f);
+                        int bar_height = (int)(bars_right[i] * center_y * 0.8f);
                         
-                        RECT barRect = {x + 1, center_y, x + bar_width - 1, center_y + bar_height};
+                        RECT barRect = {m_layout.bar_left[i] + m_layout.bar_inset, center_y,
+                                        m_layout.bar_right[i] - m_layout.bar_inset, center_y + bar_height};
                         FillRect(hdc, &barRect, barBrush);
                     }
                     
@@ -633,19 +1252,20 @@ public:
                 break;
             case STYLE_BLOCKS:
                 {
-                    int bar_width = rc.right / NUM_BARS;
                     HBRUSH blockBrush = CreateSolidBrush(right_color);
                     
                     for (int i = 0; i < NUM_BARS; i++) {
-                        int x = i * bar_width;
-                        int bar_height = (int)(m_bars_right[i] * center_y * 0.8f);
-                        int num_blocks = (bar_height / 8) + 1;
+                        int bar_height = (int)(bars_right[i] * center_y * 0.8f);
+                        int num_blocks = (bar_height / m_layout.block_pitch) + 1;
                         
                         for (int j = 0; j < num_blocks; j++) {
-                            int block_y = center_y + j * 8;
+                            int block_y = center_y + j * m_layout.block_pitch;
                             if (block_y > center_y + bar_height) break;
                             
-                            RECT blockRect = {x + 2, block_y + 2, x + bar_width - 2, block_y + 6};
+                            RECT blockRect = {m_layout.bar_left[i] + m_layout.block_inset,
+                                              block_y + m_layout.block_gap,
+                                              m_layout.bar_right[i] - m_layout.block_inset,
+                                              block_y + m_layout.block_gap + m_layout.block_size};
                             FillRect(hdc, &blockRect, blockBrush);
                         }
                     }
@@ -655,14 +1275,14 @@ public:
                 break;
             case STYLE_DOTS:
                 {
-                    int bar_width = rc.right / NUM_BARS;
                     HBRUSH dotBrush = CreateSolidBrush(right_color);
+                    int r = m_layout.dot_radius;
                     
                     for (int i = 0; i < NUM_BARS; i++) {
-                        int x = i * bar_width + bar_width / 2;
-                        int y = center_y + (int)(m_bars_right[i] * center_y * 0.8f);
+                        int x = m_layout.bar_center[i];
+                        int y = center_y + (int)(bars_right[i] * center_y * 0.8f);
                         
-                        RECT dotRect = {x - 3, y - 3, x + 3, y + 3};
+                        RECT dotRect = {x - r, y - r, x + r, y + r};
                         FillRect(hdc, &dotRect, dotBrush);
                     }
                     
@@ -680,42 +1300,197 @@ public:
         DeleteObject(centerPen);
     }
     
+    static void reset_overlay_text(overlay_text& t) {
+        t.text[0] = 0;
+        t.length = 0;
+        t.extent.cx = t.extent.cy = 0;
+        t.key[0] = t.key[1] = t.key[2] = -1;
+    }
+    
+    static bool overlay_text_changed(overlay_text& t, t_int64 a, t_int64 b, t_int64 c) {
+        if (t.key[0] == a && t.key[1] == b && t.key[2] == c) return false;
+        t.key[0] = a;
+        t.key[1] = b;
+        t.key[2] = c;
+        return true;
+    }
+    
+    void refresh_time_text() {
+        int format = m_text_format;
+        if (format == TEXT_SAMPLES && m_sample_rate == 0) format = TEXT_ELAPSED;
+        
+        t_int64 value = (t_int64)m_playback_position;
+        t_int64 total = (t_int64)m_track_length;
+        
+        switch(format) {
+            case TEXT_REMAINING:
+                value = (t_int64)ceil(m_track_length - m_playback_position);
+                break;
+            case TEXT_SAMPLES:
+                // m_playback_position only moves once a second - query the
+                // position at paint time for this mode so the count is live
+                value = (t_int64)(static_api_ptr_t<playback_control>()->playback_get_position() * m_sample_rate);
+                total = (t_int64)(m_track_length * m_sample_rate);
+                break;
+            case TEXT_BITRATE:
+                total = m_bitrate;
+                break;
+        }
+        
+        if (!overlay_text_changed(m_time_text, format, value, total)) return;
+        
+        switch(format) {
+            case TEXT_REMAINING:
+                m_time_text.length = swprintf_s(m_time_text.text, L"-%d:%02d / %d:%02d",
+                    (int)(value / 60), (int)(value % 60), (int)(total / 60), (int)(total % 60));
+                break;
+            case TEXT_SAMPLES:
+                m_time_text.length = swprintf_s(m_time_text.text, L"%lld / %lld", value, total);
+                break;
+            case TEXT_BITRATE:
+                m_time_text.length = swprintf_s(m_time_text.text, L"%d:%02d | %d kbps",
+                    (int)(value / 60), (int)(value % 60), (int)total);
+                break;
+            default:
+                m_time_text.length = swprintf_s(m_time_text.text, L"%d:%02d / %d:%02d",
+                    (int)(value / 60), (int)(value % 60), (int)(total / 60), (int)(total % 60));
+                break;
+        }
+        m_overlay_dirty = true;
+    }
+    
+    void refresh_mode_text() {
+        int bpm = m_show_bpm ? (int)(m_beat.bpm() + 0.5f) : 0;
+        if (!overlay_text_changed(m_mode_text, m_visualization_style, m_channel_mode, bpm)) return;
+        
+        const WCHAR* style_names[] = {L"Lines", L"Bars", L"Blocks", L"Dots"};
+        const WCHAR* channel_names[] = {L"Mono", L"Stereo"};
+        
+        if (bpm > 0) {
+            m_mode_text.length = swprintf_s(m_mode_text.text, L"%d BPM | %s | %s",
+                bpm, style_names[m_visualization_style], channel_names[m_channel_mode]);
+        } else {
+            m_mode_text.length = swprintf_s(m_mode_text.text, L"%s | %s",
+                style_names[m_visualization_style], channel_names[m_channel_mode]);
+        }
+        m_overlay_dirty = true;
+    }
+    
+    void release_overlay() {
+        if (!m_overlay_dc) return;
+        
+        SelectObject(m_overlay_dc, m_overlay_old_font);
+        SelectObject(m_overlay_dc, m_overlay_old_bmp);
+        DeleteObject(m_overlay_bmp);
+        DeleteDC(m_overlay_dc);
+        if (m_overlay_font) DeleteObject(m_overlay_font);
+        
+        m_overlay_dc = NULL;
+        m_overlay_bmp = NULL;
+        m_overlay_font = NULL;
+        m_overlay_width = 0;
+    }
+    
+    void create_overlay(HDC hdc, int width) {
+        release_overlay();
+        
+        m_overlay_dc = CreateCompatibleDC(hdc);
+        m_overlay_bmp = CreateCompatibleBitmap(hdc, width, m_layout.overlay_height);
+        m_overlay_old_bmp = SelectObject(m_overlay_dc, m_overlay_bmp);
+        
+        // The strip is keyed out on the background colour, so text must not blend into it:
+        // antialiased or ClearType edge pixels would survive as a halo over the bars
+        LOGFONT lf;
+        if (GetObject(m_font, sizeof(lf), &lf)) {
+            lf.lfQuality = NONANTIALIASED_QUALITY;
+            m_overlay_font = CreateFontIndirect(&lf);
+        }
+        m_overlay_old_font = SelectObject(m_overlay_dc, m_overlay_font ? m_overlay_font : m_font);
+        SetBkMode(m_overlay_dc, TRANSPARENT);
+        
+        m_overlay_width = width;
+        m_overlay_dirty = true;
+    }
+    
+    void draw_overlay(HDC hdc) {
+        if (m_layout.width <= 0) return;
+        
+        refresh_time_text();
+        refresh_mode_text();
+        
+        // Released by update_layout whenever the geometry changes
+        if (!m_overlay_dc) {
+            create_overlay(hdc, m_layout.width);
+        }
+        
+        // Re-render the cached strip only when one of the strings changed;
+        // the background colour doubles as the transparency key
+        if (m_overlay_dirty) {
+            RECT strip = {0, 0, m_overlay_width, m_layout.overlay_height};
+            HBRUSH keyBrush = CreateSolidBrush(m_clr_background);
+            FillRect(m_overlay_dc, &strip, keyBrush);
+            DeleteObject(keyBrush);
+            
+            SetTextColor(m_overlay_dc, m_clr_position);
+            GetTextExtentPoint32(m_overlay_dc, m_time_text.text, m_time_text.length, &m_time_text.extent);
+            GetTextExtentPoint32(m_overlay_dc, m_mode_text.text, m_mode_text.length, &m_mode_text.extent);
+            
+            TextOut(m_overlay_dc, m_layout.overlay_margin, 0, m_time_text.text, m_time_text.length);
+            TextOut(m_overlay_dc, m_overlay_width - m_layout.overlay_margin - m_mode_text.extent.cx, 0,
+                m_mode_text.text, m_mode_text.length);
+            
+            m_overlay_dirty = false;
+        }
+        
+        TransparentBlt(hdc, 0, m_layout.overlay_top, m_overlay_width, m_layout.overlay_height,
+            m_overlay_dc, 0, 0, m_overlay_width, m_layout.overlay_height, m_clr_background);
+    }
+    
     void on_paint() {
         PAINTSTRUCT ps;
         HDC hdc = BeginPaint(m_hwnd, &ps);
         
-        RECT rc;
-        GetClientRect(m_hwnd, &rc);
+        update_display();
+        
+        if (!m_back_dc) {
+            EndPaint(m_hwnd, &ps);
+            return;
+        }
         
-        HDC memDC = CreateCompatibleDC(hdc);
-        HBITMAP memBmp = CreateCompatibleBitmap(hdc, rc.right, rc.bottom);
-        HBITMAP oldBmp = (HBITMAP)SelectObject(memDC, memBmp);
+        RECT rc = {0, 0, m_layout.width, m_layout.height};
+        HDC memDC = m_back_dc;
         
         // Background
         HBRUSH bgBrush = CreateSolidBrush(m_clr_background);
         FillRect(memDC, &rc, bgBrush);
         DeleteObject(bgBrush);
         
+        // Beat accent flashes the bars towards the highlight colour
+        COLORREF bar_color = m_clr_bar;
+        if (m_beat_accents) {
+            bar_color = blend_color(m_clr_bar, m_clr_position, m_beat.accent() * 0.6f);
+        }
+        
         // Draw spectrum based on mode
         if (m_channel_mode == CHANNEL_MONO) {
             // Mono visualization
             switch(m_visualization_style) {
                 case STYLE_LINES:
-                    draw_lines(memDC, rc, m_bars, m_clr_bar);
+                    draw_lines(memDC, rc, m_display + spectrum_analyzer::FRAME_BARS, bar_color);
                     break;
                 case STYLE_BARS:
-                    draw_bars(memDC, rc, m_bars, m_clr_bar);
+                    draw_bars(memDC, rc, m_display + spectrum_analyzer::FRAME_BARS, bar_color);
                     break;
                 case STYLE_BLOCKS:
-                    draw_blocks(memDC, rc, m_bars, m_clr_bar);
+                    draw_blocks(memDC, rc, m_display + spectrum_analyzer::FRAME_BARS, bar_color);
                     break;
                 case STYLE_DOTS:
-                    draw_dots(memDC, rc, m_bars, m_clr_bar);
+                    draw_dots(memDC, rc, m_display + spectrum_analyzer::FRAME_BARS, bar_color);
                     break;
             }
         } else {
             // Stereo mirrored
-            draw_stereo_mirrored(memDC, rc);
+            draw_stereo_mirrored(memDC, rc, bar_color);
         }
         
         // Draw seekbar overlay
@@ -723,7 +1498,7 @@ public:
             int pos_x = (int)((m_playback_position / m_track_length) * rc.right);
             
             // Vertical position line
-            HPEN posPen = CreatePen(PS_SOLID, 3, m_clr_position);
+            HPEN posPen = CreatePen(PS_SOLID, m_layout.position_width, m_clr_position);
             HPEN oldPen = (HPEN)SelectObject(memDC, posPen);
             MoveToEx(memDC, pos_x, 0, NULL);
             LineTo(memDC, pos_x, rc.bottom);
@@ -731,44 +1506,19 @@ public:
             DeleteObject(posPen);
             
             // Bottom progress bar
-            HPEN progPen = CreatePen(PS_SOLID, 4, m_clr_played);
+            HPEN progPen = CreatePen(PS_SOLID, m_layout.progress_width, m_clr_played);
             oldPen = (HPEN)SelectObject(memDC, progPen);
-            MoveToEx(memDC, 0, rc.bottom - 2, NULL);
-            LineTo(memDC, pos_x, rc.bottom - 2);
+            MoveToEx(memDC, 0, m_layout.progress_y, NULL);
+            LineTo(memDC, pos_x, m_layout.progress_y);
             SelectObject(memDC, oldPen);
             DeleteObject(progPen);
             
-            // Time text
-            WCHAR time_str[64];
-            int cur_min = (int)(m_playback_position / 60);
-            int cur_sec = (int)m_playback_position % 60;
-            int tot_min = (int)(m_track_length / 60);
-            int tot_sec = (int)m_track_length % 60;
-            swprintf_s(time_str, L"%d:%02d / %d:%02d", cur_min, cur_sec, tot_min, tot_sec);
-            
-            SetBkMode(memDC, TRANSPARENT);
-            SetTextColor(memDC, m_clr_position);
-            
-            RECT text_rc = {10, 10, 200, 30};
-            DrawText(memDC, time_str, -1, &text_rc, DT_LEFT);
-            
-            // Mode and style indicator
-            const WCHAR* style_names[] = {L"Lines", L"Bars", L"Blocks", L"Dots"};
-            const WCHAR* channel_names[] = {L"Mono", L"Stereo"};
-            
-            WCHAR mode_str[64];
-            swprintf_s(mode_str, L"%s | %s", style_names[m_visualization_style], channel_names[m_channel_mode]);
-            
-            RECT mode_rc = {rc.right - 150, 10, rc.right - 10, 30};
-            DrawText(memDC, mode_str, -1, &mode_rc, DT_RIGHT);
+            // Time and mode text
+            draw_overlay(memDC);
         }
         
         BitBlt(hdc, 0, 0, rc.right, rc.bottom, memDC, 0, 0, SRCCOPY);
         
-        SelectObject(memDC, oldBmp);
-        DeleteObject(memBmp);
-        DeleteDC(memDC);
-        
         EndPaint(m_hwnd, &ps);
     }
     
@@ -777,9 +1527,38 @@ public:
         update_playback_state();
     }
     
+    void queue_handoff(bool to_silence) {
+        // Back to back (e.g. a track change right before stop) - start the earlier one now
+        if (m_handoff_pending) apply_handoff(m_handoff_time);
+        
+        double time = 0;
+        if (!m_vis_stream.is_valid() || !m_vis_stream->get_absolute_time(time)) time = 0;
+        
+        m_handoff_pending = true;
+        m_handoff_to_silence = to_silence;
+        m_handoff_time = time;
+        m_handoff_deadline = wall_time() + m_latency_ms / 1000.0;
+    }
+    
+    void apply_handoff(double time) {
+        m_trace.write_event(TRACE_HANDOFF, wall_time(), m_handoff_to_silence, time);
+        m_analyzer.begin_handoff();
+        m_beat.reset();
+        m_handoff_pending = false;
+    }
+    
     void on_playback_new_track(metadb_handle_ptr p_track) override {
         m_current_track = p_track;
+        
+        // Cross-fade rather than jump between the two tracks' analysis
+        queue_handoff(false);
+        
+        // Nominal bitrate until the decoder reports a dynamic one; usually
+        // resolved already by the prefetch during the previous track
+        m_bitrate = p_track.is_valid() ? resolve_track(p_track).bitrate : 0;
+        
         update_playback_state();
+        prefetch_next_track();
     }
     
     void on_playback_stop(play_control::t_stop_reason p_reason) override {
@@ -787,6 +1566,13 @@ public:
         m_track_length = 0;
         m_playback_position = 0;
         m_current_track.release();
+        
+        queue_handoff(true);
+    }
+    
+    void on_playback_edited(metadb_handle_ptr p_track) override {
+        // Tags changed - the cached length/bitrate may be stale
+        forget_track(p_track);
     }
     
     void on_playback_pause(bool p_state) override {
@@ -796,15 +1582,21 @@ public:
     void on_playback_time(double p_time) override {
         m_playback_position = p_time;
         
-        // If we still don't have track length, try to get it again
+        // Decoders that only learn the length while playing report it here;
+        // the metadb fallbacks were already tried at track change
         if (m_track_length <= 0 && m_is_playing) {
-            update_playback_state();
+            m_track_length = static_api_ptr_t<playback_control>()->playback_get_length();
         }
     }
     
     void on_playback_seek(double p_time) override {
         m_playback_position = p_time;
     }
+    
+    void on_playback_dynamic_info(const file_info & p_info) override {
+        t_int64 bitrate = p_info.info_get_bitrate_vbr();
+        if (bitrate > 0) m_bitrate = bitrate;
+    }
 };
 
 // UI element factory
@@ -0,0 +1,742 @@
+// Spectrum Seekbar V10 - headless trace replay
+// Feeds a trace recorded with "Record Trace" back through the analysis and frame
+// interpolation pipeline and reports per-stage timings plus the recorded timer jitter.
+//
+// Build (Linux):  g++ -O2 -std=c++11 -pthread -I.. spectrum_replay.cpp -o spectrum_replay
+// Build (MSVC):   cl /O2 /EHsc /I.. spectrum_replay.cpp
+//
+// Usage: spectrum_replay <trace.bin> [--realtime]
+//        spectrum_replay --clicks <bpm> [seconds]
+//        spectrum_replay --check
+//   --realtime   pace ticks and paints at the recorded wall clock instead of maximum speed
+//   --clicks     synthesize a click track instead of reading a trace and report the
+//                detected onsets and tempo
+//   --check      run synthetic signals through the analysis and verify bar placement,
+//                floor/clamping, stereo separation, smoothing, peak decay, cross-fades, click track
+//                onsets and tempo, and per-stage time budgets; exits with 1 if anything is off (build with -O2 for budgets)
+
+#include "spectrum_analysis.h"
+#include "spectrum_export.h"
+
+#include <algorithm>
+#include <chrono>
+#include <complex>
+#include <stdarg.h>
+#include <thread>
+
+typedef std::chrono::steady_clock replay_clock;
+
+struct stage_stats {
+    const char* name;
+    const char* unit;
+    std::vector<double> values;
+
+    stage_stats(const char* p_name, const char* p_unit) : name(p_name), unit(p_unit) {}
+
+    void add(double value) { values.push_back(value); }
+
+    double percentile(int p) {
+        if (values.empty()) return 0;
+        std::sort(values.begin(), values.end());
+        return values[values.size() * p / 100];
+    }
+
+    void report() {
+        if (values.empty()) {
+            printf("  %-22s %8s\n", name, "-");
+            return;
+        }
+
+        std::sort(values.begin(), values.end());
+        double sum = 0;
+        for (size_t i = 0; i < values.size(); i++) sum += values[i];
+
+        printf("  %-22s %8u  mean %9.3f  p50 %9.3f  p99 %9.3f  max %9.3f %s\n",
+            name, (unsigned)values.size(), sum / values.size(),
+            values[values.size() / 2], values[values.size() * 99 / 100], values.back(), unit);
+    }
+};
+
+static double elapsed_us(replay_clock::time_point start) {
+    return std::chrono::duration<double, std::micro>(replay_clock::now() - start).count();
+}
+
+// Mirrors what the component does per timer tick, analysis frame and paint
+struct replay_pipeline {
+    spectrum_analyzer analyzer;
+    spectrum_beat_detector beat;
+    spectrum_frame_history frames;
+    float display[spectrum_analyzer::FRAME_FLOATS];
+    spectrum_export_buffer exported;
+
+    stage_stats analysis, beat_detection, push, publish, interpolate;
+    stage_stats tick_interval, paint_interval, frames_per_tick;
+
+    double last_tick, last_paint;
+    int tick_frames;
+    unsigned ticks_without_time;
+    unsigned held_ticks;
+    unsigned onsets;
+    unsigned handoffs;
+    unsigned resets;
+    double checksum;
+
+    replay_pipeline()
+        : analysis("analysis", "us"), beat_detection("beat detection", "us"),
+          push("frame push", "us"), publish("export publish", "us"), interpolate("interpolate", "us"),
+          tick_interval("timer tick interval", "ms"), paint_interval("paint interval", "ms"),
+          frames_per_tick("frames per tick", ""),
+          last_tick(-1), last_paint(-1), tick_frames(0), ticks_without_time(0), held_ticks(0), onsets(0), handoffs(0), resets(0), checksum(0) {
+        memset((void*)&exported, 0, sizeof(exported));
+        spectrum_export_init(&exported);
+    }
+
+    void chunk(double time, const float* data, unsigned samples, unsigned channels) {
+        replay_clock::time_point t0 = replay_clock::now();
+        analyzer.process(data, samples, channels);
+        analysis.add(elapsed_us(t0));
+
+        t0 = replay_clock::now();
+        beat.process(analyzer.levels());
+        beat_detection.add(elapsed_us(t0));
+        if (beat.onset()) onsets++;
+
+        t0 = replay_clock::now();
+        frames.push(time, analyzer);
+        push.add(elapsed_us(t0));
+
+        // Same work the component does per frame before handing it to readers
+        t0 = replay_clock::now();
+        float values[spectrum_analyzer::FRAME_FLOATS];
+        analyzer.capture(values);
+        spectrum_export_frame frame;
+        memset(&frame, 0, sizeof(frame));
+        frame.time = time;
+        frame.bpm = beat.bpm();
+        frame.accent = beat.accent();
+        memcpy(frame.bars, values + spectrum_analyzer::FRAME_BARS, sizeof(frame.bars));
+        memcpy(frame.peaks, values + spectrum_analyzer::FRAME_PEAKS, sizeof(frame.peaks));
+        memcpy(frame.bars_left, values + spectrum_analyzer::FRAME_LEFT, sizeof(frame.bars_left));
+        memcpy(frame.bars_right, values + spectrum_analyzer::FRAME_RIGHT, sizeof(frame.bars_right));
+        spectrum_export_write(&exported, frame);
+        publish.add(elapsed_us(t0));
+
+        tick_frames++;
+    }
+
+    void tick(double wall_time, bool has_time) {
+        count_tick(wall_time);
+
+        // The frame history is reset by its own record, like in the component
+        if (!has_time) {
+            analyzer.decay();
+            beat.decay();
+            ticks_without_time++;
+        }
+    }
+
+    // Stop queued but not heard yet - the component keeps showing the last frame
+    void hold(double wall_time) {
+        count_tick(wall_time);
+        held_ticks++;
+    }
+
+    void count_tick(double wall_time) {
+        if (last_tick >= 0) {
+            tick_interval.add((wall_time - last_tick) * 1000.0);
+            frames_per_tick.add(tick_frames);
+        }
+        last_tick = wall_time;
+        tick_frames = 0;
+    }
+
+    void reset() {
+        frames.reset();
+        resets++;
+    }
+
+    void handoff() {
+        analyzer.begin_handoff();
+        beat.reset();
+        handoffs++;
+    }
+
+    void paint(double wall_time, double time) {
+        if (last_paint >= 0) paint_interval.add((wall_time - last_paint) * 1000.0);
+        last_paint = wall_time;
+
+        replay_clock::time_point t0 = replay_clock::now();
+        if (!frames.interpolate(time, display)) analyzer.capture(display);
+        interpolate.add(elapsed_us(t0));
+
+        checksum += display[spectrum_analyzer::FRAME_BARS];
+    }
+
+    void report() {
+        printf("Recorded timing:\n");
+        tick_interval.report();
+        paint_interval.report();
+        frames_per_tick.report();
+        printf("  %-22s %8u\n", "ticks without time", ticks_without_time);
+        printf("  %-22s %8u\n", "ticks holding a stop", held_ticks);
+        printf("  %-22s %8u\n", "track handoffs", handoffs);
+        printf("  %-22s %8u\n", "frame resets", resets);
+        printf("Pipeline stages:\n");
+        analysis.report();
+        beat_detection.report();
+        push.report();
+        publish.report();
+        interpolate.report();
+        printf("Beat detection: %u onsets, %.1f BPM (confidence %.2f)\n", onsets, beat.bpm(), beat.confidence());
+        printf("checksum %.6f\n", checksum);
+    }
+};
+
+static int replay_trace(const char* path, bool realtime) {
+    spectrum_trace_reader reader;
+    if (!reader.open(fopen(path, "rb"))) {
+        fprintf(stderr, "%s: not a spectrum seekbar trace (or incompatible version)\n", path);
+        return 1;
+    }
+
+    if (reader.header().analysis_rate != (uint32_t)spectrum_frame_history::ANALYSIS_RATE) {
+        fprintf(stderr, "warning: trace recorded at %u Hz analysis rate, replaying at %d Hz\n",
+            reader.header().analysis_rate, spectrum_frame_history::ANALYSIS_RATE);
+    }
+
+    replay_pipeline pipeline;
+    double first_wall = -1;
+
+    replay_clock::time_point start = replay_clock::now();
+    spectrum_trace_record record;
+
+    while (reader.next(record)) {
+        if (record.type == TRACE_CHUNK) {
+            pipeline.chunk(record.time, record.data.empty() ? NULL : &record.data[0], record.samples, record.channels);
+            continue;
+        }
+
+        if (first_wall < 0) first_wall = record.wall_time;
+        if (realtime) {
+            std::this_thread::sleep_until(start + std::chrono::duration_cast<replay_clock::duration>(
+                std::chrono::duration<double>(record.wall_time - first_wall)));
+        }
+
+        if (record.type == TRACE_TICK) pipeline.tick(record.wall_time, record.has_time);
+        else if (record.type == TRACE_PAINT) pipeline.paint(record.wall_time, record.time);
+        else if (record.type == TRACE_HANDOFF) pipeline.handoff();
+        else if (record.type == TRACE_RESET) pipeline.reset();
+        else if (record.type == TRACE_HOLD) pipeline.hold(record.wall_time);
+    }
+
+    if (reader.error()) {
+        fprintf(stderr, "%s: corrupt or incompatible trace: %s at offset %ld - report below is incomplete\n",
+            path, reader.error(), reader.offset());
+    }
+
+    printf("%s: replayed in %.1f ms (%s)\n", path, elapsed_us(start) / 1000.0, realtime ? "realtime" : "max speed");
+    pipeline.report();
+    return reader.error() ? 1 : 0;
+}
+
+// Broadband click on every beat over a -60 dB floor, one spectrum per analysis frame;
+// returns the number of clicks
+static unsigned run_click_track(replay_pipeline& pipeline, double bpm, double seconds) {
+    const int rate = spectrum_frame_history::ANALYSIS_RATE;
+    const unsigned bins = 512, channels = 2;
+    std::vector<float> spectrum(bins * channels);
+
+    double period = 60.0 * rate / bpm;
+    double next_click = 0;
+    unsigned clicks = 0;
+    int frame_count = (int)(seconds * rate);
+
+    for (int frame = 0; frame < frame_count; frame++) {
+        double time = (double)frame / rate;
+
+        bool click = frame >= (int)floor(next_click + 0.5);
+        if (click) {
+            next_click += period;
+            clicks++;
+        }
+        std::fill(spectrum.begin(), spectrum.end(), click ? 0.5f : 0.001f);
+
+        pipeline.tick(time, true);
+        pipeline.chunk(time, &spectrum[0], bins, channels);
+        pipeline.paint(time, time - 0.5 / rate);
+    }
+
+    return clicks;
+}
+
+static int replay_clicks(double bpm, double seconds) {
+    replay_pipeline pipeline;
+    unsigned clicks = run_click_track(pipeline, bpm, seconds);
+
+    printf("click track: %.1f BPM, %.0f s, %u clicks\n", bpm, seconds, clicks);
+    pipeline.report();
+    return 0;
+}
+
+// Synthetic spectra for --check, shaped like get_spectrum_absolute(..., 1024): 512 bins per
+// channel from a periodic Hann window, scaled so a full-scale sine at a bin centre reads 1.0
+static const unsigned CHECK_FFT_SIZE = 1024;
+static const unsigned CHECK_BINS = CHECK_FFT_SIZE / 2;
+static const double CHECK_SAMPLE_RATE = 44100;
+static const double CHECK_PI = 3.14159265358979323846;
+
+static void check_fft(std::vector<std::complex<double> >& x) {
+    const size_t n = x.size();
+    for (size_t i = 1, j = 0; i < n; i++) {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) std::swap(x[i], x[j]);
+    }
+
+    for (size_t len = 2; len <= n; len <<= 1) {
+        std::complex<double> step = std::polar(1.0, -2 * CHECK_PI / len);
+        for (size_t i = 0; i < n; i += len) {
+            std::complex<double> w = 1;
+            for (size_t k = 0; k < len / 2; k++) {
+                std::complex<double> a = x[i + k], b = x[i + k + len / 2] * w;
+                x[i + k] = a + b;
+                x[i + k + len / 2] = a - b;
+                w *= step;
+            }
+        }
+    }
+}
+
+// bin: sine frequency in FFT bins (fractional for off-centre), amplitude 0 for silence
+static std::vector<double> check_sine(double bin, double amplitude) {
+    std::vector<double> signal(CHECK_FFT_SIZE);
+    for (unsigned i = 0; i < CHECK_FFT_SIZE; i++) signal[i] = amplitude * sin(2 * CHECK_PI * bin * i / CHECK_FFT_SIZE + 0.3);
+    return signal;
+}
+
+// Full-scale white noise, deterministic per seed
+static std::vector<double> check_noise(uint32_t& seed) {
+    std::vector<double> signal(CHECK_FFT_SIZE);
+    for (unsigned i = 0; i < CHECK_FFT_SIZE; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        signal[i] = (seed >> 8) / 8388608.0 - 1.0;
+    }
+    return signal;
+}
+
+static void check_magnitudes(const std::vector<double>& signal, float* out, unsigned channels) {
+    std::vector<std::complex<double> > x(CHECK_FFT_SIZE);
+    double window_sum = 0;
+    for (unsigned i = 0; i < CHECK_FFT_SIZE; i++) {
+        double w = 0.5 - 0.5 * cos(2 * CHECK_PI * i / CHECK_FFT_SIZE);
+        x[i] = signal[i] * w;
+        window_sum += w;
+    }
+
+    check_fft(x);
+    for (unsigned i = 0; i < CHECK_BINS; i++) out[i * channels] = (float)(std::abs(x[i]) * 2 / window_sum);
+}
+
+static std::vector<float> check_spectrum(const std::vector<double>& left, const std::vector<double>& right) {
+    std::vector<float> spectrum(CHECK_BINS * 2);
+    check_magnitudes(left, &spectrum[0], 2);
+    check_magnitudes(right, &spectrum[1], 2);
+    return spectrum;
+}
+
+static std::vector<float> check_spectrum(const std::vector<double>& mono) {
+    return check_spectrum(mono, mono);
+}
+
+static int check_loudest_bar(const float* values) {
+    return (int)(std::max_element(values, values + spectrum_analyzer::NUM_BARS) - values);
+}
+
+struct check_context {
+    unsigned checks, failures;
+    const char* group;
+
+    check_context() : checks(0), failures(0), group("") {}
+
+    void begin(const char* name) {
+        group = name;
+        printf("%s\n", name);
+    }
+
+    bool expect(bool ok, const char* format, ...) {
+        checks++;
+        if (ok) return true;
+
+        failures++;
+        va_list args;
+        va_start(args, format);
+        printf("  FAIL [%s] ", group);
+        vprintf(format, args);
+        printf("\n");
+        va_end(args);
+        return false;
+    }
+
+    bool near(double value, double expected, double tolerance, const char* what, int index) {
+        return expect(fabs(value - expected) <= tolerance, "%s[%d] = %.6f, expected %.6f +- %g",
+            what, index, value, expected, tolerance);
+    }
+};
+
+// Feed the same spectrum until the smoothing has settled
+static void check_settle(spectrum_analyzer& analyzer, const std::vector<float>& spectrum, unsigned channels) {
+    for (int i = 0; i < 60; i++) analyzer.process(&spectrum[0], CHECK_BINS, channels);
+}
+
+// Expected loudest bar for a sine, worked out by hand from the bar layout (bar b covers
+// FFT bins floor(2^(b/4)) up to, not including, floor(2^((b+1)/4)), at least one bin;
+// bin = frequency * 1024 / sample rate). Where several low bars share a bin the first
+// one is the loudest.
+struct placement_case {
+    double sample_rate;
+    double frequency;
+    int bar;
+};
+
+static const placement_case PLACEMENT_CASES[] = {
+    { 44100,    60,  0 },   // bin 1.39 -> bin 1, shared by bars 0-3
+    { 44100,   100,  4 },   // bin 2.32 -> bin 2, shared by bars 4-6
+    { 44100,   250, 11 },   // bin 5.80 -> bins 6-7
+    { 44100,   440, 13 },   // bin 10.2 -> bins 9-10
+    { 44100,  1000, 18 },   // bin 23.2 -> bins 22-25
+    { 44100,  2000, 22 },   // bin 46.4 -> bins 45-52
+    { 44100,  3000, 24 },   // bin 69.7 -> bins 64-75
+    { 44100,  5000, 27 },   // bin 116  -> bins 107-127
+    { 44100,  8000, 30 },   // bin 186  -> bins 181-214
+    { 44100, 10000, 31 },   // bin 232  -> bins 215-255
+    { 48000,   440, 13 },   // bin 9.39 -> bins 9-10
+    { 48000,  1000, 17 },   // bin 21.3 -> bins 19-21
+    { 48000,  4000, 25 },   // bin 85.3 -> bins 76-89
+    { 96000,  1000, 14 },   // bin 10.7 -> mostly bin 11, bars 13 (9-10) / 14 (11-12)
+};
+
+static void check_placement(check_context& check) {
+    check.begin("bar placement");
+    spectrum_analyzer analyzer;
+
+    for (size_t i = 0; i < sizeof(PLACEMENT_CASES) / sizeof(PLACEMENT_CASES[0]); i++) {
+        const placement_case& c = PLACEMENT_CASES[i];
+        analyzer.reset();
+        check_settle(analyzer, check_spectrum(check_sine(c.frequency * CHECK_FFT_SIZE / c.sample_rate, 1.0)), 2);
+        int bar = check_loudest_bar(analyzer.levels());
+        check.expect(bar == c.bar, "%.0f Hz at %.0f Hz lands in bar %d, expected %d", c.frequency, c.sample_rate, bar, c.bar);
+    }
+
+    // Full-scale 1 kHz at 44.1 kHz: near 0 dB in bar 18, only window leakage far away
+    // (bar 14 ends at bin 13, bar 22 starts at bin 45)
+    analyzer.reset();
+    check_settle(analyzer, check_spectrum(check_sine(1000.0 * CHECK_FFT_SIZE / 44100, 1.0)), 2);
+    check.expect(analyzer.levels()[18] > 0.9f, "1 kHz full-scale level %.3f, expected > 0.9", analyzer.levels()[18]);
+    for (int i = 0; i < spectrum_analyzer::NUM_BARS; i++) {
+        if (i <= 14 || i >= 22) {
+            check.expect(analyzer.levels()[i] < 0.05f, "1 kHz sine leaks %.3f into bar %d", analyzer.levels()[i], i);
+        }
+    }
+
+    // Independent of the layout: sweeping a sine upwards in quarter bins never moves
+    // the loudest bar down, and the top bar is reached
+    int previous = 0;
+    for (double bin = 1; bin < CHECK_BINS / 2; bin += 0.25) {
+        analyzer.reset();
+        check_settle(analyzer, check_spectrum(check_sine(bin, 1.0)), 2);
+        int bar = check_loudest_bar(analyzer.levels());
+        check.expect(bar >= previous, "sine at bin %.2f lands in bar %d, below bar %d of a lower tone", bin, bar, previous);
+        previous = std::max(previous, bar);
+    }
+    check.expect(previous == spectrum_analyzer::NUM_BARS - 1, "frequency sweep tops out at bar %d", previous);
+}
+
+static void check_floor(check_context& check) {
+    check.begin("floor and clamping");
+    spectrum_analyzer analyzer;
+
+    // Bar 12 is the single bin 8, so a bin-centred sine maps straight to its dB value
+    const int bar = 12;
+    const double amplitudes[] = { 1.0, 0.1, 0.01, 0.001, 0.00001 };
+    const double expected[] = { 1.0, 2.0 / 3.0, 1.0 / 3.0, 0.0, 0.0 };
+    for (int i = 0; i < 5; i++) {
+        analyzer.reset();
+        check_settle(analyzer, check_spectrum(check_sine(8, amplitudes[i])), 2);
+        check.near(analyzer.levels()[bar], expected[i], 0.005, "level at -dB step", i);
+        check.near(analyzer.bars()[bar], expected[i], 0.005, "bar at -dB step", i);
+    }
+
+    // Silence: everything exactly at the floor
+    analyzer.reset();
+    check_settle(analyzer, check_spectrum(check_sine(0, 0)), 2);
+    float values[spectrum_analyzer::FRAME_FLOATS];
+    analyzer.capture(values);
+    for (int i = 0; i < spectrum_analyzer::FRAME_FLOATS; i++) {
+        check.expect(values[i] == 0, "silence leaves %.6f at frame value %d", values[i], i);
+    }
+
+    // Magnitudes above full scale clamp to 1, never beyond
+    std::vector<float> hot(CHECK_BINS * 2, 10.0f);
+    analyzer.reset();
+    check_settle(analyzer, hot, 2);
+    analyzer.capture(values);
+    for (int i = 0; i < spectrum_analyzer::FRAME_FLOATS; i++) {
+        check.near(values[i], 1.0, 1e-6, "over full scale frame value", i);
+    }
+
+    // Full-scale noise stays finite and in range, and a flat spectrum gives flat upper bars
+    uint32_t seed = 1;
+    analyzer.reset();
+    double sums[spectrum_analyzer::NUM_BARS] = { 0 };
+    for (int frame = 0; frame < 600; frame++) {
+        std::vector<float> spectrum = check_spectrum(check_noise(seed), check_noise(seed));
+        analyzer.process(&spectrum[0], CHECK_BINS, 2);
+        analyzer.capture(values);
+        for (int i = 0; i < spectrum_analyzer::FRAME_FLOATS; i++) {
+            if (!check.expect(values[i] >= 0 && values[i] <= 1, "noise frame %d value %d = %f", frame, i, values[i])) return;
+        }
+        for (int i = 0; i < spectrum_analyzer::NUM_BARS; i++) sums[i] += analyzer.levels()[i];
+    }
+
+    double low = 1, high = 0;
+    for (int i = 20; i < spectrum_analyzer::NUM_BARS; i++) {
+        low = std::min(low, sums[i] / 600);
+        high = std::max(high, sums[i] / 600);
+    }
+    check.expect(high - low < 0.05, "white noise upper bars range %.3f..%.3f, expected flat", low, high);
+}
+
+static void check_stereo(check_context& check) {
+    check.begin("stereo separation");
+    spectrum_analyzer analyzer;
+    std::vector<double> tone = check_sine(8, 1.0), silence = check_sine(0, 0);
+    const int bar = 12;
+
+    // The combined bar is the channel power average: -3 dB when one side is silent
+    const double half_power = (60.0 + 10 * log10(0.5)) / 60.0;
+
+    for (int side = 0; side < 2; side++) {
+        analyzer.reset();
+        check_settle(analyzer, side == 0 ? check_spectrum(tone, silence) : check_spectrum(silence, tone), 2);
+        const float* loud = side == 0 ? analyzer.bars_left() : analyzer.bars_right();
+        const float* quiet = side == 0 ? analyzer.bars_right() : analyzer.bars_left();
+        const char* name = side == 0 ? "hard left" : "hard right";
+
+        check.near(loud[bar], 1.0, 0.005, name, bar);
+        check.near(analyzer.bars()[bar], half_power, 0.005, name, bar);
+        for (int i = 0; i < spectrum_analyzer::NUM_BARS; i++) {
+            check.expect(quiet[i] == 0, "%s leaks %.6f into the other channel at bar %d", name, quiet[i], i);
+        }
+    }
+
+    // Mono input feeds both sides identically
+    analyzer.reset();
+    std::vector<float> mono(CHECK_BINS);
+    check_magnitudes(check_sine(23.2, 0.5), &mono[0], 1);
+    check_settle(analyzer, mono, 1);
+    for (int i = 0; i < spectrum_analyzer::NUM_BARS; i++) {
+        check.expect(analyzer.bars_left()[i] == analyzer.bars()[i] && analyzer.bars_right()[i] == analyzer.bars()[i],
+            "mono bar %d differs between channels", i);
+    }
+}
+
+static void check_dynamics(check_context& check) {
+    check.begin("smoothing and peak decay");
+    spectrum_analyzer analyzer;
+    std::vector<float> tone = check_spectrum(check_sine(8, 1.0)), silence = check_spectrum(check_sine(0, 0));
+    const int bar = 12;
+
+    // Attack closes half the gap per frame and the peak follows the bar up
+    double expected = 0;
+    for (int frame = 1; frame <= 12; frame++) {
+        analyzer.process(&tone[0], CHECK_BINS, 2);
+        expected += (1.0 - expected) * 0.5;
+        check.near(analyzer.bars()[bar], expected, 1e-5, "attack frame", frame);
+        check.near(analyzer.peaks()[bar], expected, 1e-5, "peak during attack frame", frame);
+    }
+
+    // Release is 0.9 per frame for the bar and 0.98 per frame for the peak
+    double bar_level = analyzer.bars()[bar], peak = analyzer.peaks()[bar];
+    for (int frame = 1; frame <= 60; frame++) {
+        analyzer.process(&silence[0], CHECK_BINS, 2);
+        bar_level *= 0.9;
+        peak *= 0.98;
+        check.near(analyzer.bars()[bar], bar_level, 1e-5, "release frame", frame);
+        check.near(analyzer.peaks()[bar], peak, 1e-5, "peak decay frame", frame);
+    }
+
+    // Without analysis data everything decays and snaps to zero below 0.01
+    analyzer.reset();
+    check_settle(analyzer, tone, 2);
+    int frames = 0;
+    while (analyzer.bars()[bar] > 0 && frames < 1000) {
+        analyzer.decay();
+        frames++;
+    }
+    check.expect(frames == (int)ceil(log(0.01) / log(0.9)), "decay reached zero after %d frames, expected %d",
+        frames, (int)ceil(log(0.01) / log(0.9)));
+
+    // Frames are interpolated linearly between analysis times
+    spectrum_frame_history history;
+    analyzer.reset();
+    history.push(1.0, analyzer);
+    check_settle(analyzer, tone, 2);
+    history.push(1.0 + 1.0 / spectrum_frame_history::ANALYSIS_RATE, analyzer);
+    float values[spectrum_analyzer::FRAME_FLOATS];
+    history.interpolate(1.0 + 0.25 / spectrum_frame_history::ANALYSIS_RATE, values);
+    check.near(values[spectrum_analyzer::FRAME_BARS + bar], 0.25 * analyzer.bars()[bar], 1e-5, "interpolated bar", bar);
+}
+
+static void check_handoff(check_context& check) {
+    check.begin("track change cross-fade");
+    spectrum_analyzer analyzer;
+    std::vector<float> loud = check_spectrum(check_sine(8, 1.0)), quiet = check_spectrum(check_sine(8, 0.01));
+    const int bar = 12;
+
+    // Loud track, then a -40 dB one: the live side starts from zero and attacks towards
+    // 1/3 on its own, the output moves from the snapshot to it along a smoothstep
+    check_settle(analyzer, loud, 2);
+    double from_bar = analyzer.bars()[bar], from_peak = analyzer.peaks()[bar];
+    analyzer.begin_handoff();
+
+    double live = 0;
+    float values[spectrum_analyzer::FRAME_FLOATS];
+    for (int frame = 1; frame <= spectrum_analyzer::HANDOFF_FRAMES + 5; frame++) {
+        analyzer.process(&quiet[0], CHECK_BINS, 2);
+        live += (1.0 / 3.0 - live) * 0.5;
+        double t = std::min(1.0, (double)frame / spectrum_analyzer::HANDOFF_FRAMES);
+        double weight = t * t * (3 - 2 * t);
+
+        check.near(analyzer.bars()[bar], live, 1e-5, "live bar after track change, frame", frame);
+        analyzer.capture(values);
+        check.near(values[spectrum_analyzer::FRAME_BARS + bar], from_bar + (live - from_bar) * weight, 1e-5,
+            "cross-faded bar, frame", frame);
+        check.near(values[spectrum_analyzer::FRAME_PEAKS + bar], from_peak + (live - from_peak) * weight, 1e-5,
+            "cross-faded peak, frame", frame);
+    }
+
+    // Stop: nothing live remains, the output fades from the snapshot to zero
+    analyzer.reset();
+    check_settle(analyzer, loud, 2);
+    from_bar = analyzer.bars()[bar];
+    analyzer.begin_handoff();
+    for (int frame = 1; frame <= spectrum_analyzer::HANDOFF_FRAMES; frame++) {
+        analyzer.decay();
+        double t = (double)frame / spectrum_analyzer::HANDOFF_FRAMES;
+        analyzer.capture(values);
+        check.near(values[spectrum_analyzer::FRAME_BARS + bar], from_bar * (1 - t * t * (3 - 2 * t)), 1e-5,
+            "fade out after stop, frame", frame);
+    }
+}
+
+// Clicks land on whole analysis frames, so a period that isn't a whole number of frames
+// alternates between its two neighbours; the tempo estimate is only asked to be within
+// CLICK_BPM_TOLERANCE of the nominal tempo, in the right octave.
+static const double CLICK_BPM_TOLERANCE = 0.015;
+
+static void check_clicks(check_context& check) {
+    check.begin("click track onsets and tempo");
+    const double tempos[] = { 61, 90, 120, 140, 174, 196 };
+
+    for (size_t i = 0; i < sizeof(tempos) / sizeof(tempos[0]); i++) {
+        replay_pipeline pipeline;
+        unsigned clicks = run_click_track(pipeline, tempos[i], 30);
+        double bpm = pipeline.beat.bpm();
+
+        check.expect(pipeline.onsets == clicks, "%.0f BPM: %u onsets for %u clicks", tempos[i], pipeline.onsets, clicks);
+        check.expect(fabs(bpm - tempos[i]) <= tempos[i] * CLICK_BPM_TOLERANCE,
+            "%.0f BPM detected as %.1f BPM (tolerance %.1f%%)", tempos[i], bpm, CLICK_BPM_TOLERANCE * 100);
+    }
+
+    // A track change drops the previous tempo rather than carrying it into the next track,
+    // and nothing is reported once playback has stopped
+    replay_pipeline pipeline;
+    run_click_track(pipeline, 174, 30);
+    pipeline.handoff();
+    check.expect(pipeline.beat.bpm() == 0, "%.1f BPM still reported right after a track change", pipeline.beat.bpm());
+    run_click_track(pipeline, 90, 30);
+    check.expect(fabs(pipeline.beat.bpm() - 90) <= 90 * CLICK_BPM_TOLERANCE,
+        "90 BPM after a 174 BPM track detected as %.1f BPM", pipeline.beat.bpm());
+
+    pipeline.handoff();
+    for (int frame = 0; frame < 600; frame++) pipeline.tick((double)frame / spectrum_frame_history::ANALYSIS_RATE, false);
+    check.expect(pipeline.beat.bpm() == 0 && pipeline.beat.accent() < 0.01f,
+        "%.1f BPM (accent %.2f) still reported 10 s after stop", pipeline.beat.bpm(), pipeline.beat.accent());
+}
+
+// Per frame time budgets in microseconds (p99). A 60 Hz frame has 16667 us for everything,
+// these leave an order of magnitude of headroom over a typical desktop with -O2.
+static void check_budgets(check_context& check) {
+    check.begin("time budgets (p99)");
+    replay_pipeline pipeline;
+    uint32_t seed = 7;
+
+    for (int frame = 0; frame < 3000; frame++) {
+        double time = (double)frame / spectrum_frame_history::ANALYSIS_RATE;
+        std::vector<float> spectrum = check_spectrum(check_noise(seed), check_noise(seed));
+        pipeline.tick(time, true);
+        pipeline.chunk(time, &spectrum[0], CHECK_BINS, 2);
+        pipeline.paint(time, time - 0.5 / spectrum_frame_history::ANALYSIS_RATE);
+    }
+
+    struct budget { stage_stats* stage; double limit_us; };
+    budget budgets[] = {
+        { &pipeline.analysis, 100 },
+        { &pipeline.beat_detection, 20 },
+        { &pipeline.push, 10 },
+        { &pipeline.publish, 10 },
+        { &pipeline.interpolate, 10 },
+    };
+
+    for (size_t i = 0; i < sizeof(budgets) / sizeof(budgets[0]); i++) {
+        double p99 = budgets[i].stage->percentile(99);
+        printf("  %-22s %9.3f us (budget %.0f us)\n", budgets[i].stage->name, p99, budgets[i].limit_us);
+        check.expect(p99 <= budgets[i].limit_us, "%s p99 %.3f us over budget %.0f us",
+            budgets[i].stage->name, p99, budgets[i].limit_us);
+    }
+}
+
+static int run_checks() {
+    check_context check;
+    check_placement(check);
+    check_floor(check);
+    check_stereo(check);
+    check_dynamics(check);
+    check_handoff(check);
+    check_clicks(check);
+    check_budgets(check);
+
+    printf("%u checks, %u failed\n", check.checks, check.failures);
+    return check.failures ? 1 : 0;
+}
+
+int main(int argc, char** argv) {
+    const char* path = NULL;
+    bool realtime = false;
+    double clicks_bpm = 0, clicks_seconds = 30;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--check") == 0) {
+            return run_checks();
+        } else if (strcmp(argv[i], "--realtime") == 0) {
+            realtime = true;
+        } else if (strcmp(argv[i], "--clicks") == 0 && i + 1 < argc) {
+            clicks_bpm = atof(argv[++i]);
+            if (i + 1 < argc && argv[i + 1][0] != '-') clicks_seconds = atof(argv[++i]);
+        } else {
+            path = argv[i];
+        }
+    }
+
+    if (clicks_bpm > 0) return replay_clicks(clicks_bpm, clicks_seconds);
+
+    if (!path) {
+        fprintf(stderr, "usage: spectrum_replay <trace.bin> [--realtime]\n"
+                        "       spectrum_replay --clicks <bpm> [seconds]\n"
+                        "       spectrum_replay --check\n");
+        return 2;
+    }
+
+    return replay_trace(path, realtime);
+}